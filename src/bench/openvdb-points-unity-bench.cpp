@@ -0,0 +1,411 @@
+// Stage level benchmark: generates deterministic synthetic clouds as binary PLY, then times each
+// stage of conversion and meshing separately, with peak RSS, across a sweep of thread counts.
+// Results are written as JSON.
+//
+//   openvdb-points-unity-bench --distribution uniform,surface --points 1M,10M --threads 1,4,16
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include <tbb/task_arena.h>
+#include "../openvdb-points-unity.h"
+#include "synthetic-cloud.h"
+
+using namespace std;
+using namespace openvdb::points;
+
+// Memory -----------------------------------------------------------------------------------
+
+/// Reset the peak RSS counter so the next reading covers one stage. Only Linux supports this;
+/// elsewhere readings are the peak of the whole process so far.
+static bool resetPeakRSS()
+{
+#ifdef __linux__
+    ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    return bool(clearRefs);
+#else
+    return false;
+#endif
+}
+
+static uint64_t peakRSS()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return uint64_t(counters.PeakWorkingSetSize);
+#elif defined(__linux__)
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return uint64_t(strtoull(line.c_str() + 6, nullptr, 10)) * 1024;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return uint64_t(usage.ru_maxrss); // bytes on macOS
+#endif
+}
+
+// Results ----------------------------------------------------------------------------------
+
+struct StageResult
+{
+    string name;
+    double seconds;
+    uint64_t peakRSS;
+};
+
+struct RunResult
+{
+    string distribution;
+    uint64_t points;
+    int threads;
+    bool stagePeaks;
+    float voxelSize;
+    uint64_t fileBytes;
+    size_t meshVertices, meshTriangles;
+    size_t picksHit;
+    vector<StageResult> stages;
+};
+
+class StageTimer
+{
+public:
+    explicit StageTimer(RunResult &result) : mResult(result) {}
+
+    template <typename F>
+    void operator()(const string &name, F stage)
+    {
+        mResult.stagePeaks = resetPeakRSS();
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        stage();
+        StageResult stageResult;
+        stageResult.name = name;
+        stageResult.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        stageResult.peakRSS = peakRSS();
+        mResult.stages.push_back(stageResult);
+        cerr << "  " << name << ": " << stageResult.seconds << " s, peak " << (stageResult.peakRSS >> 20) << " MB" << endl;
+    }
+
+private:
+    RunResult &mResult;
+};
+
+static void writeJSON(ostream &out, const vector<RunResult> &results)
+{
+    out << "[\n";
+    for (size_t r = 0; r < results.size(); ++r)
+    {
+        const RunResult &result = results[r];
+        out << "  {\"distribution\": \"" << result.distribution << "\", \"points\": " << result.points
+            << ", \"threads\": " << result.threads << ", \"voxel_size\": " << result.voxelSize
+            << ", \"file_bytes\": " << result.fileBytes << ", \"mesh_vertices\": " << result.meshVertices
+            << ", \"mesh_triangles\": " << result.meshTriangles << ", \"picks_hit\": " << result.picksHit
+            << ", \"peak_rss_scope\": \"" << (result.stagePeaks ? "stage" : "process") << "\",\n   \"stages\": [";
+        for (size_t s = 0; s < result.stages.size(); ++s)
+        {
+            const StageResult &stage = result.stages[s];
+            out << (s ? ",\n              " : "") << "{\"name\": \"" << stage.name << "\", \"seconds\": " << stage.seconds
+                << ", \"peak_rss_bytes\": " << stage.peakRSS << "}";
+        }
+        out << "]}" << (r + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Pipeline ---------------------------------------------------------------------------------
+
+static const int PICK_RAYS_PER_SIDE = 32;
+
+/// The steps of cloudToVDB, readPointGridFromFile and buildPointGridMesh, with the same
+/// parameters, timed one by one.
+static RunResult runPipeline(const string &plyPath, const string &vdbPath, bool mesh, const PointMeshOptions &meshOptions)
+{
+    RunResult result = RunResult();
+    StageTimer stage(result);
+
+    PLYReader::PointData<float, uint8_t> cloud;
+    stage("readply", [&] { cloud = PLYReader::readply(plyPath); });
+    result.points = cloud.vertices.size();
+
+    PLYPositionWrapper positionsWrapper(cloud.vertices);
+    openvdb::math::Transform::Ptr transform;
+    stage("computeVoxelSize", [&] {
+        result.voxelSize = computeVoxelSize(positionsWrapper, 8);
+        transform = openvdb::math::Transform::createLinearTransform(result.voxelSize);
+    });
+    openvdb::tools::PointIndexGrid::Ptr pointIndex;
+    stage("createPointIndexGrid", [&] {
+        pointIndex = openvdb::tools::createPointIndexGrid<openvdb::tools::PointIndexGrid>(positionsWrapper, *transform);
+    });
+    PointDataGrid::Ptr grid;
+    stage("createPointDataGrid", [&] {
+        grid = createPointDataGrid<NullCodec, PointDataGrid>(*pointIndex, positionsWrapper, *transform);
+        grid->setName("Points");
+    });
+    stage("populateAttribute", [&] {
+        vector<unique_ptr<PointAttributeColumn>> columns;
+        cloudAttributeColumns(cloud, defaultPointConversionOptions(), columns);
+        populatePointAttributes(grid->tree(), pointIndex->tree(), columns);
+    });
+    cloud = PLYReader::PointData<float, uint8_t>();
+    pointIndex.reset();
+
+    stage("write", [&] {
+        openvdb::GridPtrVec grids;
+        grids.push_back(grid);
+        PointConversionReport report = PointConversionReport();
+        writePointGrids(vdbPath, grids, FileCompressionDefault, &report);
+        result.fileBytes = report.bytesWritten;
+    });
+    grid.reset();
+    stage("loadPointGrid", [&] { grid = loadPointGrid(vdbPath, "Points"); });
+    const string cachePath = vdbPath + ".pcache";
+    stage("bakePointCache", [&] { bakePointCacheFile(*grid, cachePath); });
+    stage("openPointCache", [&] {
+        // touch every page of the positions, as an upload would
+        PointCacheFile cache(cachePath);
+        size_t bytes = 0;
+        const uint8_t *positions = static_cast<const uint8_t *>(cache.section(PointCachePositions, bytes));
+        volatile uint8_t sink = 0;
+        for (size_t offset = 0; offset < bytes; offset += POINT_CACHE_ALIGNMENT)
+            sink = sink + positions[offset];
+    });
+    LeafBoundsTable leafBounds;
+    PointQueryIndex queryIndex;
+    stage("pointQueryIndex", [&] {
+        leafBounds.build(grid->tree());
+        queryIndex.build(leafBounds, computeLeafPointOffsets(grid->tree()));
+    });
+    stage("pickPoints", [&] {
+        // a square of rays down the z axis across the bounds, with a pick radius of one point voxel
+        const openvdb::BBoxd bounds = computeWorldPointBounds(*grid);
+        const openvdb::Vec3d extent = bounds.extents();
+        PointQuery query(*grid, queryIndex);
+        PointQueryHit hit;
+        for (int i = 0; i < PICK_RAYS_PER_SIDE; ++i)
+        {
+            for (int j = 0; j < PICK_RAYS_PER_SIDE; ++j)
+            {
+                const openvdb::Vec3d origin(bounds.min().x() + extent.x() * (i + 0.5) / PICK_RAYS_PER_SIDE,
+                                            bounds.min().y() + extent.y() * (j + 0.5) / PICK_RAYS_PER_SIDE,
+                                            bounds.max().z() + grid->voxelSize().x());
+                result.picksHit += query.pick(origin, openvdb::Vec3d(0.0, 0.0, -1.0), grid->voxelSize().x(), 0.0, hit);
+            }
+        }
+    });
+    if (!mesh)
+        return result;
+
+    const openvdb::Real pointVoxelSize = grid->voxelSize().x();
+    const openvdb::Real rasterVoxelSize = meshVoxelSize(pointVoxelSize, meshOptions.quality);
+    unique_ptr<PointDataParticleList> particles;
+    stage("gather", [&] {
+        particles.reset(new PointDataParticleList(*grid, meshParticleRadius(pointVoxelSize, rasterVoxelSize)));
+    });
+    openvdb::FloatGrid::Ptr floatGrid;
+    stage("rasterizeSpheres", [&] { floatGrid = rasterizePointGrid(*particles, rasterVoxelSize, nullptr); });
+    particles.reset();
+    stage("VolumeToMesh", [&] {
+        MeshData meshData;
+        meshLevelSet(*floatGrid, meshOptions, meshData);
+        result.meshVertices = meshData.pointCount;
+        result.meshTriangles = meshData.triangleCount();
+    });
+    return result;
+}
+
+// Arguments --------------------------------------------------------------------------------
+
+static vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+/// Point counts with an optional K, M or G suffix.
+static uint64_t parseCount(const string &text)
+{
+    char *end = nullptr;
+    const double value = strtod(text.c_str(), &end);
+    double scale = 1.0;
+    if (*end == 'k' || *end == 'K')
+        scale = 1e3;
+    else if (*end == 'm' || *end == 'M')
+        scale = 1e6;
+    else if (*end == 'g' || *end == 'G')
+        scale = 1e9;
+    return uint64_t(value * scale);
+}
+
+static void usage()
+{
+    cerr << "usage: openvdb-points-unity-bench [options]\n"
+            "  --distribution LIST  uniform, clustered, surface (default all)\n"
+            "  --points LIST        point counts, K/M/G suffixes allowed (default 1M)\n"
+            "  --threads LIST       thread counts to sweep (default 1 and powers of two up to all cores)\n"
+            "  --seed N             generator seed (default 1)\n"
+            "  --work-dir DIR       where generated .ply and written .vdb files go (default .)\n"
+            "  --json FILE          write results here instead of stdout\n"
+            "  --no-mesh            stop after loadPointGrid\n"
+            "  --quality Q          mesh quality: high, medium or low (default high)\n"
+            "  --adaptivity A       VolumeToMesh adaptivity (default 0)\n"
+            "  --keep-files         keep generated and written files\n";
+}
+
+int main(int argc, char **argv)
+{
+    vector<SyntheticDistribution> distributions;
+    vector<uint64_t> counts;
+    vector<int> threads;
+    uint64_t seed = 1;
+    string workDir = ".", jsonPath;
+    bool mesh = true, keepFiles = false;
+    PointMeshOptions meshOptions = defaultPointMeshOptions();
+    for (int i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--distribution" && hasValue)
+        {
+            for (const string &name : splitList(argv[++i]))
+            {
+                SyntheticDistribution distribution;
+                if (!parseSyntheticDistribution(name, distribution))
+                {
+                    cerr << "Unknown distribution " << name << endl;
+                    return 1;
+                }
+                distributions.push_back(distribution);
+            }
+        }
+        else if (arg == "--points" && hasValue)
+        {
+            for (const string &count : splitList(argv[++i]))
+                counts.push_back(parseCount(count));
+        }
+        else if (arg == "--threads" && hasValue)
+        {
+            for (const string &count : splitList(argv[++i]))
+                threads.push_back(max(atoi(count.c_str()), 1));
+        }
+        else if (arg == "--seed" && hasValue)
+            seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--work-dir" && hasValue)
+            workDir = argv[++i];
+        else if (arg == "--json" && hasValue)
+            jsonPath = argv[++i];
+        else if (arg == "--quality" && hasValue)
+        {
+            const string quality = argv[++i];
+            meshOptions.quality = quality == "low" ? Low : (quality == "medium" ? Medium : High);
+        }
+        else if (arg == "--adaptivity" && hasValue)
+            meshOptions.adaptivity = float(atof(argv[++i]));
+        else if (arg == "--no-mesh")
+            mesh = false;
+        else if (arg == "--keep-files")
+            keepFiles = true;
+        else
+        {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (distributions.empty())
+        distributions = {SyntheticUniform, SyntheticClustered, SyntheticSurface};
+    if (counts.empty())
+        counts.push_back(1000000);
+    if (threads.empty())
+    {
+        const int maxThreads = tbb::this_task_arena::max_concurrency();
+        for (int t = 1; t < maxThreads; t *= 2)
+            threads.push_back(t);
+        threads.push_back(maxThreads);
+    }
+
+    openvdbInitialize();
+    vector<RunResult> results;
+    try
+    {
+        for (SyntheticDistribution distribution : distributions)
+        {
+            for (uint64_t count : counts)
+            {
+                const string name = string("synthetic-") + syntheticDistributionName(distribution) + "-" +
+                                    to_string(count) + "-" + to_string(seed);
+                const string plyPath = workDir + "/" + name + ".ply";
+                const string vdbPath = workDir + "/" + name + ".vdb";
+                // only files this run creates are removed afterwards
+                const bool plyExisted = bool(ifstream(plyPath));
+                const bool vdbExisted = bool(ifstream(vdbPath));
+                const bool cacheExisted = bool(ifstream(vdbPath + ".pcache"));
+                if (!plyExisted)
+                {
+                    cerr << "Generating " << plyPath << endl;
+                    SyntheticCloud(distribution, seed).writePLY(plyPath, count);
+                }
+                for (int threadCount : threads)
+                {
+                    cerr << name << " on " << threadCount << " threads" << endl;
+                    tbb::task_arena arena(threadCount);
+                    RunResult result;
+                    arena.execute([&] { result = runPipeline(plyPath, vdbPath, mesh, meshOptions); });
+                    result.distribution = syntheticDistributionName(distribution);
+                    result.threads = threadCount;
+                    results.push_back(result);
+                }
+                if (!keepFiles)
+                {
+                    if (!plyExisted)
+                        remove(plyPath.c_str());
+                    if (!vdbExisted)
+                        remove(vdbPath.c_str());
+                    if (!cacheExisted)
+                        remove((vdbPath + ".pcache").c_str());
+                }
+            }
+        }
+    }
+    catch (exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        openvdbUninitialize();
+        return 1;
+    }
+    openvdbUninitialize();
+
+    if (jsonPath.empty())
+    {
+        writeJSON(cout, results);
+    }
+    else
+    {
+        ofstream json(jsonPath);
+        writeJSON(json, results);
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+using namespace std;
+
+enum SyntheticDistribution
+{
+  SyntheticUniform = 0,   // uniform in a cube
+  SyntheticClustered = 1, // gaussian blobs of varying size and population
+  SyntheticSurface = 2    // scan-like: terrain along scan lines plus facades, with sensor noise
+};
+
+inline const char *syntheticDistributionName(SyntheticDistribution distribution)
+{
+  switch (distribution)
+  {
+  case SyntheticClustered:
+    return "clustered";
+  case SyntheticSurface:
+    return "surface";
+  default:
+    return "uniform";
+  }
+}
+
+inline bool parseSyntheticDistribution(const string &name, SyntheticDistribution &distribution)
+{
+  if (name == "uniform")
+    distribution = SyntheticUniform;
+  else if (name == "clustered")
+    distribution = SyntheticClustered;
+  else if (name == "surface")
+    distribution = SyntheticSurface;
+  else
+    return false;
+  return true;
+}
+
+/// Counter based random numbers: every value depends only on the seed and the point index, so
+/// clouds are identical whatever the thread count or chunking.
+class SyntheticRandom
+{
+public:
+  SyntheticRandom(uint64_t seed, uint64_t index) : mState(seed * 0x9e3779b97f4a7c15ull + index * 0xd1b54a32d192ed03ull) {}
+
+  uint64_t next()
+  {
+    // splitmix64
+    uint64_t z = (mState += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+  /// Uniform in [0, 1).
+  float uniform() { return float(next() >> 40) * (1.0f / 16777216.0f); }
+  float gaussian()
+  {
+    const float u = max(uniform(), 1e-7f), v = uniform();
+    return sqrt(-2.0f * log(u)) * cos(6.2831853f * v);
+  }
+
+private:
+  uint64_t mState;
+};
+
+/// Generates point n of a cloud of extent world units on a side. Positions and colors are a pure
+/// function of (seed, n).
+class SyntheticCloud
+{
+public:
+  static const int CLUSTERS = 64;
+
+  SyntheticCloud(SyntheticDistribution distribution, uint64_t seed, float extent = 100.0f)
+      : mDistribution(distribution), mSeed(seed), mExtent(extent)
+  {
+    SyntheticRandom random(seed, ~uint64_t(0));
+    for (int c = 0; c < CLUSTERS; ++c)
+    {
+      for (int i = 0; i < 3; ++i)
+        mCenters[c][i] = extent * (0.1f + 0.8f * random.uniform());
+      // sizes spread over a decade so densities differ between clusters
+      mSigma[c] = extent * 0.005f * pow(10.0f, random.uniform());
+    }
+  }
+
+  void point(uint64_t n, float *xyz, uint8_t *rgb) const
+  {
+    SyntheticRandom random(mSeed, n);
+    switch (mDistribution)
+    {
+    case SyntheticClustered:
+    {
+      const int c = int(random.next() % CLUSTERS);
+      for (int i = 0; i < 3; ++i)
+        xyz[i] = mCenters[c][i] + mSigma[c] * random.gaussian();
+      break;
+    }
+    case SyntheticSurface:
+    {
+      // one scan line in 256, points jittered along it as a scanner would place them
+      const float lines = 256.0f;
+      const float line = floor(random.uniform() * lines);
+      const float x = random.uniform() * mExtent;
+      const float y = (line + 0.5f + 0.05f * random.gaussian()) * (mExtent / lines);
+      if (random.uniform() < 0.1f)
+      {
+        // facade: a vertical wall at a grid of building fronts
+        const float wall = floor(x / (mExtent / 16.0f)) * (mExtent / 16.0f);
+        xyz[0] = wall + 0.01f * random.gaussian();
+        xyz[1] = y;
+        xyz[2] = terrain(wall, y) + random.uniform() * mExtent * 0.1f;
+      }
+      else
+      {
+        xyz[0] = x;
+        xyz[1] = y;
+        xyz[2] = terrain(x, y) + 0.01f * random.gaussian();
+      }
+      break;
+    }
+    default:
+      for (int i = 0; i < 3; ++i)
+        xyz[i] = random.uniform() * mExtent;
+      break;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+      const float t = xyz[i] / mExtent;
+      rgb[i] = uint8_t(min(max(t, 0.0f), 1.0f) * 255.0f);
+    }
+  }
+
+  /// Write count points as binary PLY, in parallel chunks, without holding the cloud in memory.
+  void writePLY(const string &path, uint64_t count) const
+  {
+    ofstream out(path, ios::binary);
+    if (!out)
+      throw runtime_error("Could not open " + path);
+    const uint16_t probe = 1;
+    const bool little = *reinterpret_cast<const uint8_t *>(&probe) == 1;
+    out << "ply\n"
+        << "format " << (little ? "binary_little_endian" : "binary_big_endian") << " 1.0\n"
+        << "comment synthetic " << syntheticDistributionName(mDistribution) << " seed " << mSeed << "\n"
+        << "element vertex " << count << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+        << "end_header\n";
+    const size_t RECORD = 3 * sizeof(float) + 3;
+    const uint64_t chunk = 1 << 20;
+    vector<char> buffer(chunk * RECORD);
+    for (uint64_t begin = 0; begin < count; begin += chunk)
+    {
+      const uint64_t end = min(begin + chunk, count);
+      tbb::parallel_for(tbb::blocked_range<uint64_t>(begin, end, 4096), [&](const tbb::blocked_range<uint64_t> &range) {
+        for (uint64_t n = range.begin(); n < range.end(); ++n)
+        {
+          float xyz[3];
+          uint8_t rgb[3];
+          this->point(n, xyz, rgb);
+          char *record = buffer.data() + (n - begin) * RECORD;
+          memcpy(record, xyz, sizeof(xyz));
+          memcpy(record + sizeof(xyz), rgb, sizeof(rgb));
+        }
+      });
+      out.write(buffer.data(), streamsize((end - begin) * RECORD));
+    }
+    if (!out)
+      throw runtime_error("Could not write " + path);
+  }
+
+private:
+  float terrain(float x, float y) const
+  {
+    const float k = 6.2831853f / mExtent;
+    return mExtent * (0.05f * sin(2.0f * k * x) * cos(3.0f * k * y) + 0.02f * sin(11.0f * k * (x + y)));
+  }
+
+  SyntheticDistribution mDistribution;
+  uint64_t mSeed;
+  float mExtent;
+  float mCenters[CLUSTERS][3];
+  float mSigma[CLUSTERS];
+};
@@ -0,0 +1,130 @@
+#pragma once
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+using namespace std;
+
+// Metadata of level sets rasterized from points, checked before a stored one is reused. The radius is
+// tagged when rasterized, the point count and checksum when written to a file.
+static const char *const LEVEL_SET_RADIUS_META = "particle_radius";
+static const char *const LEVEL_SET_POINT_COUNT_META = "point_count";
+static const char *const LEVEL_SET_POINT_CHECKSUM_META = "point_checksum";
+
+/// What identifies the points a level set was rasterized from: their count and a checksum of every
+/// leaf origin and voxel offset, so points moved to other voxels no longer match.
+struct PointGridIdentity
+{
+  uint64_t count;
+  uint64_t checksum;
+};
+
+static const uint64_t POINT_CHECKSUM_BASIS = 14695981039346656037ULL;
+
+/// One FNV-1a step over a whole word rather than a byte.
+inline uint64_t mixPointChecksum(uint64_t hash, uint64_t value)
+{
+  return (hash ^ value) * 1099511628211ULL;
+}
+
+/// Hash every leaf in parallel, then fold the leaf hashes in LeafManager order. Costs a pass over
+/// the tree, so it is only computed for level sets read from or written to a file.
+inline PointGridIdentity pointGridIdentity(const openvdb::points::PointDataTree &tree)
+{
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(tree);
+  vector<uint64_t> leafHashes(leafManager.leafCount());
+  vector<uint64_t> leafCounts(leafManager.leafCount());
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, leafHashes.size()), [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t n = range.begin(); n < range.end(); ++n)
+    {
+      const LeafT &leaf = leafManager.leaf(n);
+      const openvdb::Coord &origin = leaf.origin();
+      uint64_t hash = mixPointChecksum(POINT_CHECKSUM_BASIS, uint32_t(origin.x()));
+      hash = mixPointChecksum(hash, uint32_t(origin.y()));
+      hash = mixPointChecksum(hash, uint32_t(origin.z()));
+      for (openvdb::Index i = 0; i < LeafT::SIZE; ++i)
+        hash = mixPointChecksum(hash, openvdb::Index32(leaf.getValue(i)));
+      leafHashes[n] = hash;
+      leafCounts[n] = openvdb::Index32(leaf.getValue(LeafT::SIZE - 1));
+    }
+  });
+  PointGridIdentity identity = {0, POINT_CHECKSUM_BASIS};
+  for (size_t n = 0; n < leafHashes.size(); ++n)
+  {
+    identity.checksum = mixPointChecksum(identity.checksum, leafHashes[n]);
+    identity.count += leafCounts[n];
+  }
+  return identity;
+}
+
+/// Tag a level set rasterized at radius; tagLevelSetPoints adds the identity once it is written.
+inline void tagLevelSet(openvdb::GridBase &grid, double radius)
+{
+  grid.insertMeta(LEVEL_SET_RADIUS_META, openvdb::DoubleMetadata(radius));
+}
+
+inline void tagLevelSetPoints(openvdb::GridBase &grid, const PointGridIdentity &points)
+{
+  grid.insertMeta(LEVEL_SET_POINT_COUNT_META, openvdb::Int64Metadata(int64_t(points.count)));
+  grid.insertMeta(LEVEL_SET_POINT_CHECKSUM_META, openvdb::Int64Metadata(int64_t(points.checksum)));
+}
+
+/// True if grid, which may hold only metadata and transform, was rasterized with these parameters
+/// from the points identified by points. Level sets written without a checksum never match.
+inline bool levelSetMatches(const openvdb::GridBase &grid, double voxelSize, double radius, const PointGridIdentity &points)
+{
+  openvdb::DoubleMetadata::ConstPtr storedRadius = grid.getMetadata<openvdb::DoubleMetadata>(LEVEL_SET_RADIUS_META);
+  openvdb::Int64Metadata::ConstPtr storedCount = grid.getMetadata<openvdb::Int64Metadata>(LEVEL_SET_POINT_COUNT_META);
+  openvdb::Int64Metadata::ConstPtr storedChecksum = grid.getMetadata<openvdb::Int64Metadata>(LEVEL_SET_POINT_CHECKSUM_META);
+  if (!storedRadius || !storedCount || !storedChecksum || storedCount->value() != int64_t(points.count) ||
+      storedChecksum->value() != int64_t(points.checksum))
+    return false;
+  const double tolerance = 1e-6 * voxelSize;
+  return fabs(grid.voxelSize().x() - voxelSize) <= tolerance && fabs(storedRadius->value() - radius) <= tolerance;
+}
+
+/// Level sets rasterized from one point grid, keyed by the raster voxel size and sphere radius they
+/// were built with, so meshing again with another iso value or adaptivity skips straight to
+/// VolumeToMesh.
+class LevelSetCache
+{
+public:
+  /// File the point grid was read from in full; level sets stored in it are loaded on a miss.
+  string source;
+
+  openvdb::FloatGrid::Ptr find(double voxelSize, double radius) const
+  {
+    map<pair<double, double>, openvdb::FloatGrid::Ptr>::const_iterator it = mGrids.find(make_pair(voxelSize, radius));
+    return it == mGrids.end() ? openvdb::FloatGrid::Ptr() : it->second;
+  }
+
+  void insert(double voxelSize, double radius, const openvdb::FloatGrid::Ptr &grid)
+  {
+    mGrids[make_pair(voxelSize, radius)] = grid;
+  }
+
+  /// Drop every level set and the source, once the points change.
+  void clear()
+  {
+    mGrids.clear();
+    source.clear();
+  }
+
+  size_t size() const { return mGrids.size(); }
+
+  void grids(openvdb::GridPtrVec &out) const
+  {
+    for (const auto &entry : mGrids)
+      out.push_back(entry.second);
+  }
+
+private:
+  map<pair<double, double>, openvdb::FloatGrid::Ptr> mGrids;
+};
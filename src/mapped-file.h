@@ -0,0 +1,143 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/// Read-only memory mapping of an entire file. The mapping is released when
+/// the object is destroyed, so pointers handed out by data() must not outlive it.
+class MappedFile
+{
+public:
+  explicit MappedFile(const string &filepath) : mData(nullptr), mSize(0)
+  {
+#ifdef _WIN32
+    mFile = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    mMapping = NULL;
+    if (mFile == INVALID_HANDLE_VALUE)
+      throw runtime_error("Failed to open " + filepath);
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size))
+    {
+      CloseHandle(mFile);
+      throw runtime_error("Failed to stat " + filepath);
+    }
+    mSize = (size_t)size.QuadPart;
+    if (mSize == 0)
+      return;
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mMapping != NULL)
+      mData = (const uint8_t *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if (mData == nullptr)
+    {
+      if (mMapping != NULL)
+        CloseHandle(mMapping);
+      CloseHandle(mFile);
+      throw runtime_error("Failed to map " + filepath);
+    }
+#else
+    mFile = open(filepath.c_str(), O_RDONLY);
+    if (mFile < 0)
+      throw runtime_error("Failed to open " + filepath);
+    struct stat info;
+    if (fstat(mFile, &info) != 0)
+    {
+      close(mFile);
+      throw runtime_error("Failed to stat " + filepath);
+    }
+    mSize = (size_t)info.st_size;
+    if (mSize == 0)
+      return;
+    void *ptr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+    if (ptr == MAP_FAILED)
+    {
+      close(mFile);
+      throw runtime_error("Failed to map " + filepath);
+    }
+    mData = (const uint8_t *)ptr;
+#endif
+  }
+
+  ~MappedFile()
+  {
+#ifdef _WIN32
+    if (mData != nullptr)
+      UnmapViewOfFile(mData);
+    if (mMapping != NULL)
+      CloseHandle(mMapping);
+    CloseHandle(mFile);
+#else
+    if (mData != nullptr)
+      munmap((void *)mData, mSize);
+    close(mFile);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return mData; }
+  size_t size() const { return mSize; }
+
+  /// Hint that [offset, offset + length) will be read front to back.
+  void adviseSequential(size_t offset, size_t length) const
+  {
+#ifndef _WIN32
+    if (mData == nullptr || offset >= mSize)
+      return;
+    // madvise wants a page aligned start address
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t start = offset - (offset % page);
+    const size_t end = offset + length < mSize ? offset + length : mSize;
+    madvise((void *)(mData + start), end - start, MADV_SEQUENTIAL);
+#else
+    (void)offset;
+    (void)length;
+#endif
+  }
+
+  /// Drop resident pages in [offset, offset + length); they are faulted back in on access.
+  void release(size_t offset, size_t length) const
+  {
+#ifndef _WIN32
+    if (mData == nullptr || offset >= mSize)
+      return;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    // only whole pages inside the range are dropped
+    const size_t start = (offset + page - 1) / page * page;
+    const size_t end = (offset + length < mSize ? offset + length : mSize) / page * page;
+    if (start < end)
+      madvise((void *)(mData + start), end - start, MADV_DONTNEED);
+#else
+    if (mData == nullptr || offset >= mSize)
+      return;
+    const size_t end = offset + length < mSize ? offset + length : mSize;
+    VirtualUnlock((LPVOID)(mData + offset), end - offset);
+#endif
+  }
+
+private:
+  const uint8_t *mData;
+  size_t mSize;
+#ifdef _WIN32
+  HANDLE mFile;
+  HANDLE mMapping;
+#else
+  int mFile;
+#endif
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <vector>
+#include <cstring>
+#include <openvdb/openvdb.h>
+#include <openvdb/tools/VolumeToMesh.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+using namespace std;
+
+/// Output of a VolumeToMesh run, kept in the mesher's own point list and polygon pools so the only
+/// copy is the one into the caller's buffers. Quads are split into two triangles on the way out.
+struct MeshData
+{
+  openvdb::tools::PointList points;
+  size_t pointCount;
+  openvdb::tools::PolygonPoolList polygons;
+  size_t polygonPoolCount;
+  /// Exclusive prefix sum of triangles per polygon pool, counting each quad as two.
+  vector<size_t> triangleOffsets;
+
+  MeshData() : pointCount(0), polygonPoolCount(0), triangleOffsets(1, 0) {}
+
+  size_t triangleCount() const { return triangleOffsets.back(); }
+
+  void clear()
+  {
+    points.reset();
+    polygons.reset();
+    pointCount = polygonPoolCount = 0;
+    triangleOffsets.assign(1, 0);
+  }
+
+  /// Take ownership of the mesher's buffers without copying them.
+  void take(openvdb::tools::VolumeToMesh &mesher)
+  {
+    pointCount = mesher.pointListSize();
+    polygonPoolCount = mesher.polygonPoolListSize();
+    points.swap(mesher.pointList());
+    polygons.swap(mesher.polygonPoolList());
+    mesher.pointList().reset();
+    mesher.polygonPoolList().reset();
+    triangleOffsets.assign(polygonPoolCount + 1, 0);
+    for (size_t i = 0; i < polygonPoolCount; ++i)
+      triangleOffsets[i + 1] = triangleOffsets[i] + polygons[i].numTriangles() + 2 * polygons[i].numQuads();
+  }
+
+  /// Write xyz per vertex.
+  void copyVertices(float *out) const
+  {
+    if (pointCount == 0)
+      return;
+    const openvdb::Vec3s *src = points.get();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, pointCount, 1 << 14),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                        memcpy(out + range.begin() * 3, src + range.begin(), range.size() * sizeof(openvdb::Vec3s));
+                      });
+  }
+
+  /// Write three indices per triangle, offset by base, each pool at its prefix offset.
+  void copyTriangles(uint32_t *out, uint32_t base = 0) const
+  {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, polygonPoolCount),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                        for (size_t i = range.begin(); i < range.end(); ++i)
+                        {
+                          const openvdb::tools::PolygonPool &pool = polygons[i];
+                          uint32_t *dst = out + triangleOffsets[i] * 3;
+                          for (size_t t = 0, e = pool.numTriangles(); t < e; ++t)
+                          {
+                            const openvdb::Vec3I &tri = pool.triangle(t);
+                            *dst++ = base + tri[0];
+                            *dst++ = base + tri[1];
+                            *dst++ = base + tri[2];
+                          }
+                          for (size_t q = 0, e = pool.numQuads(); q < e; ++q)
+                          {
+                            const openvdb::Vec4I &quad = pool.quad(q);
+                            *dst++ = base + quad[0];
+                            *dst++ = base + quad[1];
+                            *dst++ = base + quad[2];
+                            *dst++ = base + quad[0];
+                            *dst++ = base + quad[2];
+                            *dst++ = base + quad[3];
+                          }
+                        }
+                      });
+  }
+
+  /// Write area weighted vertex normals. Faces are accumulated serially since neighbouring pools
+  /// share vertices; normalization runs in parallel.
+  void computeNormals(float *out) const
+  {
+    if (pointCount == 0)
+      return;
+    memset(out, 0, pointCount * 3 * sizeof(float));
+    openvdb::Vec3s *normals = reinterpret_cast<openvdb::Vec3s *>(out);
+    const openvdb::Vec3s *p = points.get();
+    for (size_t i = 0; i < polygonPoolCount; ++i)
+    {
+      const openvdb::tools::PolygonPool &pool = polygons[i];
+      for (size_t t = 0, e = pool.numTriangles(); t < e; ++t)
+      {
+        const openvdb::Vec3I &tri = pool.triangle(t);
+        const openvdb::Vec3s n = (p[tri[1]] - p[tri[0]]).cross(p[tri[2]] - p[tri[0]]);
+        normals[tri[0]] += n;
+        normals[tri[1]] += n;
+        normals[tri[2]] += n;
+      }
+      for (size_t q = 0, e = pool.numQuads(); q < e; ++q)
+      {
+        const openvdb::Vec4I &quad = pool.quad(q);
+        const openvdb::Vec3s n = (p[quad[2]] - p[quad[0]]).cross(p[quad[3]] - p[quad[1]]);
+        for (int c = 0; c < 4; ++c)
+          normals[quad[c]] += n;
+      }
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, pointCount, 1 << 14),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                        for (size_t n = range.begin(); n < range.end(); ++n)
+                          normals[n].normalize();
+                      });
+  }
+};
@@ -1,12 +1,31 @@
 #include <iostream>
+#include <cmath>
+#include <chrono>
+#include <fstream>
 #include "openvdb-points-unity.h"
+// tinyply is header only; its implementation is compiled in this translation unit alone
+#include "vendor/tinyply.cpp"
 
 using namespace std;
 using namespace openvdb::points;
 
+template <typename ValueT>
+static void registerAttributeType()
+{
+    if (!TypedAttributeArray<ValueT>::isRegistered())
+        TypedAttributeArray<ValueT>::registerType();
+}
+
 void openvdbInitialize()
 {
     openvdb::initialize();
+    // PLY scalar properties keep their own type, including integer types OpenVDB doesn't register
+    registerAttributeType<int8_t>();
+    registerAttributeType<uint8_t>();
+    registerAttributeType<int16_t>();
+    registerAttributeType<uint16_t>();
+    registerAttributeType<int32_t>();
+    registerAttributeType<uint32_t>();
 }
 
 void openvdbUninitialize()
@@ -14,78 +33,454 @@ void openvdbUninitialize()
     openvdb::uninitialize();
 }
 
-void cloudToVDB(PLYReader::PointData<float, uint8_t> cloud, string filename)
+static double secondsSince(chrono::steady_clock::time_point start)
 {
-    try
-    {
-        if (cloud.vertices.size() == 0)
-            throw;
-        vector<openvdb::Vec3R> positions;
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/// Bytes held by the columns of a cloud.
+static size_t cloudMemUsage(const PLYReader::PointData<float, uint8_t> &cloud)
+{
+    size_t bytes = cloud.vertices.size() * sizeof(cloud.vertices[0]) + cloud.color.size() * sizeof(cloud.color[0]) +
+                   cloud.wideColor.size() * sizeof(cloud.wideColor[0]) + cloud.normals.size() * sizeof(cloud.normals[0]);
+    for (const PLYReader::ScalarColumn &scalar : cloud.scalars)
+        bytes += scalar.data.size();
+    return bytes;
+}
+
+template <typename ValueT>
+static void appendScalarColumn(const PLYReader::ScalarColumn &scalar, vector<unique_ptr<PointAttributeColumn>> &columns)
+{
+    typedef TypedPointAttributeColumn<ValueT, NullCodec, PLYScalarWrapper<ValueT>> ColumnT;
+    columns.push_back(unique_ptr<PointAttributeColumn>(new ColumnT(scalar.name, PLYScalarWrapper<ValueT>(scalar))));
+}
 
-        for (vector<PLYReader::point<float>>::iterator it = cloud.vertices.begin(); it != cloud.vertices.end(); it++)
+template <typename CodecT, typename WrapperT>
+static void appendVec3Column(const string &name, const WrapperT &wrapper, vector<unique_ptr<PointAttributeColumn>> &columns)
+{
+    typedef TypedPointAttributeColumn<openvdb::Vec3f, CodecT, WrapperT> ColumnT;
+    columns.push_back(unique_ptr<PointAttributeColumn>(new ColumnT(name, wrapper)));
+}
+
+/// Attributes of cloud beside "P": "Cd" first, with the color codec of options, then "N" with
+/// UnitVecCodec, then every other PLY property under its own name and in its own type.
+void cloudAttributeColumns(const PLYReader::PointData<float, uint8_t> &cloud, const PointConversionOptions &options,
+                           vector<unique_ptr<PointAttributeColumn>> &columns)
+{
+    const bool oneByte = options.colorCodec == ColorUnitRange8;
+    if (!cloud.wideColor.empty())
+    {
+        PLYWideColorWrapper colors(cloud.wideColor);
+        if (oneByte)
+            appendVec3Column<FixedPointCodec<true, UnitRange>>("Cd", colors, columns);
+        else
+            appendVec3Column<FixedPointCodec<false, UnitRange>>("Cd", colors, columns);
+    }
+    else if (!cloud.color.empty())
+    {
+        PLYColorWrapper colors(cloud.color);
+        if (oneByte)
+            appendVec3Column<FixedPointCodec<true, UnitRange>>("Cd", colors, columns);
+        else
+            appendVec3Column<FixedPointCodec<false, UnitRange>>("Cd", colors, columns);
+    }
+    if (!cloud.normals.empty())
+        appendVec3Column<UnitVecCodec>("N", PLYNormalWrapper(cloud.normals), columns);
+    for (const PLYReader::ScalarColumn &scalar : cloud.scalars)
+    {
+        if (scalar.name == "P" || scalar.name == "Cd" || scalar.name == "N")
+            continue;
+        switch (scalar.type)
         {
-            positions.push_back(openvdb::Vec3R(it->x, it->y, it->z));
+        case tinyply::Type::INT8:
+            appendScalarColumn<int8_t>(scalar, columns);
+            break;
+        case tinyply::Type::UINT8:
+            appendScalarColumn<uint8_t>(scalar, columns);
+            break;
+        case tinyply::Type::INT16:
+            appendScalarColumn<int16_t>(scalar, columns);
+            break;
+        case tinyply::Type::UINT16:
+            appendScalarColumn<uint16_t>(scalar, columns);
+            break;
+        case tinyply::Type::INT32:
+            appendScalarColumn<int32_t>(scalar, columns);
+            break;
+        case tinyply::Type::UINT32:
+            appendScalarColumn<uint32_t>(scalar, columns);
+            break;
+        case tinyply::Type::FLOAT32:
+            appendScalarColumn<float>(scalar, columns);
+            break;
+        case tinyply::Type::FLOAT64:
+            appendScalarColumn<double>(scalar, columns);
+            break;
+        default:
+            break;
         }
+    }
+}
+
+PointDataGrid::Ptr createPointDataGridFromCloud(const PLYReader::PointData<float, uint8_t> &cloud, const openvdb::math::Transform &transform,
+                                                const PointConversionOptions &options)
+{
+    // the builder reads straight from the reader's buffers
+    PLYPositionWrapper positionsWrapper(cloud.vertices);
+    openvdb::tools::PointIndexGrid::Ptr pointIndex;
+    {
+        ScopedPointMetricTimer timer(MetricCreatePointIndexGrid);
+        pointIndex = openvdb::tools::createPointIndexGrid<openvdb::tools::PointIndexGrid>(positionsWrapper, transform);
+    }
+    ScopedPointMetricTimer createTimer(MetricCreatePointDataGrid);
+    // positions are stored relative to their voxel, so fixed point keeps sub-voxel precision
+    PointDataGrid::Ptr grid;
+    switch (options.positionCodec)
+    {
+    case PositionFixed16:
+        grid = createPointDataGrid<FixedPointCodec<false>, PointDataGrid>(*pointIndex, positionsWrapper, transform);
+        break;
+    case PositionFixed8:
+        grid = createPointDataGrid<FixedPointCodec<true>, PointDataGrid>(*pointIndex, positionsWrapper, transform);
+        break;
+    case PositionHalf:
+        grid = createPointDataGrid<TruncateCodec, PointDataGrid>(*pointIndex, positionsWrapper, transform);
+        break;
+    default:
+        grid = createPointDataGrid<NullCodec, PointDataGrid>(*pointIndex, positionsWrapper, transform);
+        break;
+    }
 
-        if (positions.size() == 0)
-            throw;
+    grid->setName("Points");
 
-        PointAttributeVector<openvdb::Vec3R> positionsWrapper(positions);
-        int pointsPerVoxel = 8;
+    // color, normals and the other properties
+    // based on https://github.com/AcademySoftwareFoundation/openvdb/blob/f44e305f8c3181d0cbf667fe5da0510f378b9256/openvdb_houdini/houdini/VRAY_OpenVDB_Points.cc
+    recordPointMetric(MetricPointsConverted, cloud.vertices.size());
+    recordPointMetric(MetricLeavesTouched, grid->tree().leafCount());
+    vector<unique_ptr<PointAttributeColumn>> columns;
+    cloudAttributeColumns(cloud, options, columns);
+    if (!columns.empty())
+    {
+        ScopedPointMetricTimer timer(MetricPopulateAttribute);
+        populatePointAttributes(grid->tree(), pointIndex->tree(), columns);
+    }
+    recordPointMetricPeak(MetricPeakTrackedBytes, grid->memUsage() + pointIndex->memUsage() + cloudMemUsage(cloud));
+    return grid;
+}
 
-        float voxelSize = computeVoxelSize(positionsWrapper, pointsPerVoxel);
-        openvdb::math::Transform::Ptr transform = openvdb::math::Transform::createLinearTransform(voxelSize);
-        openvdb::tools::PointIndexGrid::Ptr pointIndex = openvdb::tools::createPointIndexGrid<openvdb::tools::PointIndexGrid>(positionsWrapper, *transform);
-        // no compression
-        PointDataGrid::Ptr grid = createPointDataGrid<NullCodec,
-                                                      PointDataGrid>(*pointIndex, positionsWrapper, *transform);
+/// Build the LOD pyramid of grid and add each level as a point grid named after it.
+void appendPointLODGrids(openvdb::GridPtrVec &grids, const PointDataGrid &grid, int lodLevels)
+{
+    if (lodLevels <= 0)
+        return;
+    ScopedPointMetricTimer timer(MetricBuildLOD);
+    PointLODPyramid lod;
+    lod.build(grid, lodLevels);
+    for (size_t i = 0; i < lod.levels.size(); ++i)
+        grids.push_back(lod.levels[i].toGrid(grid.getName() + "_LOD" + to_string(i + 1)));
+}
 
-        grid->setName("Points");
+/// Rasterize grid at levelSetQuality, a SampleQuality or 0 for none, and add the level set tagged
+/// with the points' identity so readers mesh straight from it, see pointGridLevelSet.
+void appendPointLevelSetGrid(openvdb::GridPtrVec &grids, const PointDataGrid &grid, int levelSetQuality)
+{
+    if (levelSetQuality < High || levelSetQuality > Low)
+        return;
+    openvdb::FloatGrid::Ptr levelSet = rasterizePointGridLevelSet(grid, SampleQuality(levelSetQuality), nullptr);
+    tagLevelSetPoints(*levelSet, pointGridIdentity(grid.tree()));
+    grids.push_back(levelSet);
+}
 
-        // handle color
-        // based on https://github.com/AcademySoftwareFoundation/openvdb/blob/f44e305f8c3181d0cbf667fe5da0510f378b9256/openvdb_houdini/houdini/VRAY_OpenVDB_Points.cc
-        if (cloud.color.size() > 0)
-        {
-            vector<openvdb::Vec3f> colors;
-            for (vector<PLYReader::rgb<uint8_t>>::iterator it = cloud.color.begin(); it != cloud.color.end(); it++)
-            {
-                colors.push_back(openvdb::Vec3f((float)it->r / 255.0f, (float)it->g / 255.0f, (float)it->b / 255.0f));
-            }
-            PointDataTree &tree = grid->tree();
-            openvdb::tools::PointIndexTree &pointIndexTree = pointIndex->tree();
-            appendAttribute<openvdb::Vec3f, FixedPointCodec<false, UnitRange>>(tree, "Cd");
-            PointAttributeVector<openvdb::Vec3f> colorWrapper(colors);
-            populateAttribute<PointDataTree, openvdb::tools::PointIndexTree, PointAttributeVector<openvdb::Vec3f>>(tree, pointIndexTree, "Cd", colorWrapper);
-        }
-        // Wrte the file
-        openvdb::io::File outfile(filename);
-        openvdb::GridPtrVec grids;
-        grids.push_back(grid);
+/// Write grids with the requested file compression, recording the write time and file size.
+void writePointGrids(const string &filename, const openvdb::GridPtrVec &grids, FileCompression compression, PointConversionReport *report)
+{
+    openvdb::io::File outfile(filename);
+    const bool blosc = compression == FileCompressionBlosc && openvdb::io::Archive::hasBloscCompression();
+    switch (compression)
+    {
+    case FileCompressionNone:
+        outfile.setCompression(openvdb::io::COMPRESS_NONE);
+        break;
+    case FileCompressionZip:
+    case FileCompressionBlosc:
+        outfile.setCompression((blosc ? openvdb::io::COMPRESS_BLOSC : openvdb::io::COMPRESS_ZIP) | openvdb::io::COMPRESS_ACTIVE_MASK);
+        break;
+    default:
+        break;
+    }
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        ScopedPointMetricTimer timer(MetricWriteFile);
         outfile.write(grids);
         outfile.close();
-        cout << "Successfully saved VDB to " << filename << endl;
     }
-    catch (...)
+    ifstream written(filename, ios::binary | ios::ate);
+    const uint64_t bytesWritten = written ? uint64_t(written.tellg()) : 0;
+    recordPointMetric(MetricBytesWritten, bytesWritten);
+    if (report)
+    {
+        report->writeSeconds = secondsSince(start);
+        report->bytesWritten = bytesWritten;
+    }
+}
+
+/// Build the point grids of cloud and write them to filename. Errors, including an empty cloud and
+/// cancellation, are thrown to the caller.
+void cloudToVDB(const PLYReader::PointData<float, uint8_t> &cloud, string filename, const PointConversionOptions &options,
+                PointConversionReport *report, JobInterrupter *interrupter)
+{
+    if (cloud.vertices.size() == 0)
+        throw runtime_error("Point cloud is empty");
+    if (report)
+        *report = PointConversionReport();
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    PLYPositionWrapper positionsWrapper(cloud.vertices);
+    int pointsPerVoxel = 8;
+
+    float voxelSize;
+    {
+        ScopedPointMetricTimer timer(MetricComputeVoxelSize);
+        voxelSize = computeVoxelSize(positionsWrapper, pointsPerVoxel);
+    }
+    jobCheckpoint(interrupter, 0.1f);
+    openvdb::math::Transform::Ptr transform = openvdb::math::Transform::createLinearTransform(voxelSize);
+    PointDataGrid::Ptr grid = createPointDataGridFromCloud(cloud, *transform, options);
+    jobCheckpoint(interrupter, 0.6f);
+
+    // Wrte the file
+    openvdb::GridPtrVec grids;
+    grids.push_back(grid);
+    appendPointLODGrids(grids, *grid, options.lodLevels);
+    appendPointLevelSetGrid(grids, *grid, options.levelSetQuality);
+    jobCheckpoint(interrupter, 0.8f);
+    if (report)
+    {
+        report->pointCount = cloud.vertices.size();
+        report->encodeSeconds = secondsSince(start);
+    }
+    writePointGrids(filename, grids, options.compression, report);
+}
+
+// Out-of-core conversion -------------------------------------------------------------------
+
+/// Concatenate the points of src onto dst, voxel by voxel. Both leaves must share a descriptor layout.
+void appendPointDataLeaf(PointDataTree::LeafNodeType &dst, const PointDataTree::LeafNodeType &src)
+{
+    typedef PointDataTree::LeafNodeType LeafT;
+    const AttributeSet &dstSet = dst.attributeSet();
+    const AttributeSet &srcSet = src.attributeSet();
+    const openvdb::Index total = openvdb::Index(dst.pointCount() + src.pointCount());
+
+    unique_ptr<AttributeSet> merged(new AttributeSet(dstSet.descriptorPtr(), total));
+    vector<PointDataTree::ValueType> offsets(LeafT::SIZE);
+    for (size_t i = 0; i < dstSet.size(); ++i)
+    {
+        AttributeArray &out = *merged->get(i);
+        const AttributeArray &a = *dstSet.getConst(i);
+        const AttributeArray &b = *srcSet.getConst(i);
+        out.expand();
+        openvdb::Index n = 0;
+        for (openvdb::Index voxel = 0; voxel < LeafT::SIZE; ++voxel)
+        {
+            const openvdb::Index aStart = voxel > 0 ? dst.getValue(voxel - 1) : 0, aEnd = dst.getValue(voxel);
+            const openvdb::Index bStart = voxel > 0 ? src.getValue(voxel - 1) : 0, bEnd = src.getValue(voxel);
+            for (openvdb::Index j = aStart; j < aEnd; ++j)
+                out.set(n++, a, j);
+            for (openvdb::Index j = bStart; j < bEnd; ++j)
+                out.set(n++, b, j);
+            offsets[voxel] = n;
+        }
+    }
+    dst.replaceAttributeSet(merged.release());
+    dst.setOffsets(offsets);
+}
+
+/// Move every leaf of source into target. Leaves that only exist in source are stolen as-is,
+/// leaves present in both are concatenated in parallel. source is left empty.
+void mergePointDataGrids(PointDataGrid &target, PointDataGrid &source)
+{
+    typedef PointDataTree::LeafNodeType LeafT;
+    ScopedPointMetricTimer timer(MetricMergeGrids);
+    PointDataTree &dstTree = target.tree();
+    PointDataTree &srcTree = source.tree();
+    if (dstTree.leafCount() == 0)
+    {
+        dstTree.merge(srcTree);
+        return;
+    }
+    const AttributeSet::Descriptor::Ptr descriptor = dstTree.cbeginLeaf()->attributeSet().descriptorPtr();
+
+    vector<LeafT *> leaves;
+    srcTree.stealNodes(leaves);
+    vector<pair<LeafT *, LeafT *>> collisions;
+    openvdb::tree::ValueAccessor<PointDataTree> accessor(dstTree);
+    for (LeafT *leaf : leaves)
+    {
+        LeafT *existing = accessor.probeLeaf(leaf->origin());
+        if (existing)
+        {
+            collisions.push_back(make_pair(existing, leaf));
+            continue;
+        }
+        leaf->resetDescriptor(descriptor);
+        accessor.addLeaf(leaf);
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, collisions.size()),
+                      [&](const tbb::blocked_range<size_t> &range) {
+                          for (size_t i = range.begin(); i < range.end(); ++i)
+                          {
+                              appendPointDataLeaf(*collisions[i].first, *collisions[i].second);
+                              delete collisions[i].second;
+                          }
+                      });
+}
+
+/// Estimate the voxel size of the full cloud from a strided sample. The sample is sized again at
+/// an eighth of its density to measure how voxel size scales with point count, which depends on
+/// whether the cloud is closer to a surface or a volume, and the result is extrapolated to the
+/// full count.
+float computeSampledVoxelSize(const PLYMappedReader &reader, int pointsPerVoxel, size_t sampleSize)
+{
+    ScopedPointMetricTimer timer(MetricComputeVoxelSize);
+    PLYReader::PointData<float, uint8_t> sample;
+    reader.sample(sampleSize, sample);
+    PLYPositionWrapper sampleWrapper(sample.vertices);
+    const float sampleVoxelSize = computeVoxelSize(sampleWrapper, pointsPerVoxel);
+    if (sample.vertices.size() >= reader.vertexCount())
+        return sampleVoxelSize;
+
+    PLYReader::PointData<float, uint8_t> sparse;
+    sparse.vertices.reserve(sample.vertices.size() / 8 + 1);
+    for (size_t n = 0; n < sample.vertices.size(); n += 8)
+        sparse.vertices.push_back(sample.vertices[n]);
+    PLYPositionWrapper sparseWrapper(sparse.vertices);
+    const float sparseVoxelSize = computeVoxelSize(sparseWrapper, pointsPerVoxel);
+
+    double dimension = 3.0;
+    if (sparseVoxelSize > sampleVoxelSize)
+        dimension = log(8.0) / log(double(sparseVoxelSize) / sampleVoxelSize);
+    dimension = openvdb::math::Clamp(dimension, 1.0, 3.0);
+    const double fraction = double(sample.vertices.size()) / reader.vertexCount();
+    return float(sampleVoxelSize * pow(fraction, 1.0 / dimension));
+}
+
+// rough working set per point of one batch: reader buffers, point index grid and partial point data grid
+static const size_t STREAMING_BYTES_PER_POINT = 64;
+
+void cloudToVDBStreaming(string plyPath, string filename, const PointConversionOptions &options,
+                         PointConversionReport *report, JobInterrupter *interrupter, LoggingCallback cb)
+{
+    // rasterizing gathers every point of the merged grid at once, far past any batch budget
+    if (options.levelSetQuality != 0)
+        throw runtime_error("A level set can't be stored within a memory budget; convert without one");
+    PLYMappedReader reader(plyPath);
+    if (!reader.isMappable())
+    {
+        // ascii and list-prefixed files can't be read in ranges, so a budget can't be kept
+        if (options.memoryBudget > 0)
+            throw runtime_error(plyPath + " is ascii or has list properties in its vertices and can't be converted "
+                                "within a memory budget; convert without one");
+        cloudToVDB(PLYReader::readply(plyPath), filename, options, report, interrupter);
+        return;
+    }
+    const size_t total = reader.vertexCount();
+    if (total == 0)
+        throw runtime_error("Point cloud is empty");
+    if (report)
+        *report = PointConversionReport();
+    // normals and scalar columns are held twice: as read and in the attribute arrays
+    const size_t bytesPerPoint = STREAMING_BYTES_PER_POINT + 2 * reader.attributeBytesPerPoint();
+    const size_t batchSize = max<size_t>(options.memoryBudget / bytesPerPoint, 1 << 16);
+    const int pointsPerVoxel = 8;
+
+    const float voxelSize = computeSampledVoxelSize(reader, pointsPerVoxel, min<size_t>(batchSize, 1 << 22));
+    openvdb::math::Transform::Ptr transform = openvdb::math::Transform::createLinearTransform(voxelSize);
+
+    PointDataGrid::Ptr grid;
+    PLYReader::PointData<float, uint8_t> batch;
+    double encodeSeconds = 0.0;
+    for (size_t begin = 0; begin < total; begin += batchSize)
+    {
+        const size_t end = min(begin + batchSize, total);
+        reader.read(begin, end, batch);
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        PointDataGrid::Ptr partial = createPointDataGridFromCloud(batch, *transform, options);
+        reader.release(begin, end);
+        if (!grid)
+            grid = partial;
+        else
+            mergePointDataGrids(*grid, *partial);
+        encodeSeconds += secondsSince(start);
+        if (cb)
+        {
+            const string message = "Converted " + to_string(end) + " of " + to_string(total) + " points";
+            cb(message.c_str());
+        }
+        jobCheckpoint(interrupter, 0.8f * float(end) / float(total));
+    }
+    // release the last batch before writing
+    batch = PLYReader::PointData<float, uint8_t>();
+
+    openvdb::GridPtrVec grids;
+    grids.push_back(grid);
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    appendPointLODGrids(grids, *grid, options.lodLevels);
+    jobCheckpoint(interrupter, 0.9f);
+    if (report)
     {
-        // TODO improve this logging
-        cout << "Something went wrong!" << endl;
+        report->pointCount = total;
+        report->encodeSeconds = encodeSeconds + secondsSince(start);
     }
+    writePointGrids(filename, grids, options.compression, report);
 }
 
 PointDataGrid::Ptr loadPointGrid(string filename, string gridName)
 {
+    ScopedPointMetricTimer timer(MetricLoadGrid);
     openvdb::io::File fileHandle(filename);
     fileHandle.open();
     PointDataGrid::Ptr grid = openvdb::gridPtrCast<PointDataGrid>(fileHandle.readGrid(gridName));
     fileHandle.close();
+    if (grid)
+        recordPointMetric(MetricLeavesTouched, grid->tree().leafCount());
+    return grid;
+}
+
+/// Open a grid through the shared cache. Readers must treat the grid as immutable since other
+/// references may hold the same one.
+PointDataGrid::Ptr loadPointGrid(string filename, string gridName, const PointGridOpenOptions &options)
+{
+    ScopedPointMetricTimer timer(MetricLoadGrid);
+    PointDataGrid::Ptr grid = PointGridCache::instance().acquire(filename, gridName, options);
+    recordPointMetric(MetricLeavesTouched, grid->tree().leafCount());
     return grid;
 }
 
+/// Load the LOD levels written by appendPointLODGrids, if the file has any.
+void loadPointLOD(string filename, string gridName, PointLODPyramid &lod)
+{
+    lod.clear();
+    openvdb::io::File fileHandle(filename);
+    fileHandle.open();
+    for (int level = 1; fileHandle.hasGrid(gridName + "_LOD" + to_string(level)); ++level)
+    {
+        PointDataGrid::Ptr grid = openvdb::gridPtrCast<PointDataGrid>(fileHandle.readGrid(gridName + "_LOD" + to_string(level)));
+        if (!grid)
+            break;
+        lod.levels.push_back(PointLODLevel());
+        lod.levels.back().fromGrid(*grid);
+    }
+    fileHandle.close();
+}
+
 template <typename GridType>
 typename GridType::Ptr downsampleGrid(typename GridType::Ptr inGrid, SampleQuality quality)
 {
+    ScopedPointMetricTimer timer(MetricResample);
     typename GridType::Ptr sampled = GridType::create();
-    sampled->setTransform(openvdb::math::Transform::createLinearTransform(0.6 * quality));
+    // coarsen relative to the input rather than to an absolute size, which ignored the input's scale
+    sampled->setTransform(openvdb::math::Transform::createLinearTransform(inGrid->voxelSize()[0] * double(quality)));
     const openvdb::math::Transform &inTransform = inGrid->transform(),
                                    &outTransform = sampled->transform();
     openvdb::Mat4R xform = inTransform.baseMap()->getAffineMap()->getMat4() *
@@ -96,6 +491,8 @@ typename GridType::Ptr downsampleGrid(typename GridType::Ptr inGrid, SampleQuali
     return sampled;
 }
 
+template openvdb::FloatGrid::Ptr downsampleGrid<openvdb::FloatGrid>(openvdb::FloatGrid::Ptr inGrid, SampleQuality quality);
+
 // Functions with C linkage
 
 bool convertPLYToVDB(const char *filename, const char *outfile, LoggingCallback cb)
@@ -120,7 +517,193 @@ bool convertPLYToVDB(const char *filename, const char *outfile, LoggingCallback
     }
 }
 
+bool convertPLYToVDBStreaming(const char *filename, const char *outfile, size_t memoryBudget, LoggingCallback cb)
+{
+    try
+    {
+        string filePath(filename);
+        string outPath(outfile);
+        string message = "Converting " + filePath + " to VDB format within " + to_string(memoryBudget >> 20) + " MB";
+        cb(message.c_str());
+        PointConversionOptions options = defaultPointConversionOptions();
+        options.memoryBudget = memoryBudget;
+        cloudToVDBStreaming(filePath, outPath, options, nullptr, nullptr, cb);
+        message = "Successfully converted " + filePath + " to " + outPath;
+        cb(message.c_str());
+        return true;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        cb(e.what());
+        return false;
+    }
+}
+
+bool convertPLYToVDBWithLOD(const char *filename, const char *outfile, int lodLevels, LoggingCallback cb)
+{
+    try
+    {
+        string filePath(filename);
+        string outPath(outfile);
+        string message = "Converting " + filePath + " to VDB format with " + to_string(lodLevels) + " LOD levels";
+        cb(message.c_str());
+        PLYReader::PointData<float, uint8_t> cloud = PLYReader::readply(filePath);
+        PointConversionOptions options = defaultPointConversionOptions();
+        options.lodLevels = lodLevels;
+        cloudToVDB(cloud, outPath, options);
+        message = "Successfully converted " + filePath + " to " + outPath;
+        cb(message.c_str());
+        return true;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        cb(e.what());
+        return false;
+    }
+}
+
+bool convertPLYToVDBWithOptions(const char *filename, const char *outfile, const PointConversionOptions *options,
+                                PointConversionReport *report, LoggingCallback cb)
+{
+    try
+    {
+        string filePath(filename);
+        string outPath(outfile);
+        const PointConversionOptions conversionOptions = options ? *options : defaultPointConversionOptions();
+        PointConversionReport conversionReport = PointConversionReport();
+        string message = "Converting " + filePath + " to VDB format";
+        cb(message.c_str());
+        if (conversionOptions.memoryBudget > 0)
+            cloudToVDBStreaming(filePath, outPath, conversionOptions, &conversionReport, nullptr, cb);
+        else
+            cloudToVDB(PLYReader::readply(filePath), outPath, conversionOptions, &conversionReport);
+        if (report)
+            *report = conversionReport;
+        message = "Successfully converted " + filePath + " to " + outPath + ": " + to_string(conversionReport.pointCount) +
+                  " points, " + to_string(conversionReport.bytesWritten) + " bytes, encoded in " +
+                  to_string(conversionReport.encodeSeconds) + " s, written in " + to_string(conversionReport.writeSeconds) + " s";
+        cb(message.c_str());
+        return true;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        cb(e.what());
+        return false;
+    }
+}
+
+/// Bake grid into cachefile, recording the time and the bytes written.
+static void bakePointGridCache(const PointDataGrid &grid, const string &cachefile, LoggingCallback cb)
+{
+    uint64_t bytesWritten;
+    {
+        ScopedPointMetricTimer timer(MetricBakePointCache);
+        bytesWritten = bakePointCacheFile(grid, cachefile);
+    }
+    recordPointMetric(MetricBytesWritten, bytesWritten);
+    string message = "Baked " + to_string(pointCount(grid.tree())) + " points to " + cachefile + ": " +
+                     to_string(bytesWritten) + " bytes";
+    cb(message.c_str());
+}
+
+bool bakePointCacheFromFile(const char *filename, const char *gridName, const char *cachefile, LoggingCallback cb)
+{
+    try
+    {
+        PointDataGrid::Ptr grid = loadPointGrid(filename, gridName);
+        if (!grid)
+            throw runtime_error(string("No point grid ") + gridName + " in " + filename);
+        bakePointGridCache(*grid, cachefile, cb);
+        return true;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        cb(e.what());
+        return false;
+    }
+}
+
+bool bakePointCache(SharedPointDataGridReference *reference, const char *cachefile, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        bakePointGridCache(*reference->gridPtr, cachefile, cb);
+        return true;
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return false;
+    }
+}
+
+PointCacheFile *openPointCache(const char *cachefile, LoggingCallback cb)
+{
+    try
+    {
+        return new PointCacheFile(cachefile);
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return nullptr;
+    }
+}
+
+void getPointCacheInfo(PointCacheFile *cache, PointCacheInfo *info)
+{
+    cache->info(*info);
+}
+
+const void *getPointCacheSection(PointCacheFile *cache, PointCacheSection section, size_t *bytes)
+{
+    size_t sectionBytes = 0;
+    const void *data = section >= 0 && section < PointCacheSectionCount ? cache->section(section, sectionBytes) : nullptr;
+    if (bytes)
+        *bytes = sectionBytes;
+    return data;
+}
+
+void closePointCache(PointCacheFile *cache)
+{
+    delete cache;
+}
+
+/// Load gridName from filename into reference, recording into its metrics, for both readPointGridFromFile
+/// and ReadPointGridJob. The stored levels and level sets cover the whole cloud, so only a read without
+/// a clip box loads the levels and remembers the file for the level sets; a clipped read leaves them
+/// to buildPointLOD and meshing. With an interrupter, loading the grid is the first half of progress.
+static void readPointGridInto(SharedPointDataGridReference *reference, const string &filename, const string &gridName,
+                              const PointGridOpenOptions &options, JobInterrupter *interrupter)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    reference->gridPtr = loadPointGrid(filename, gridName, options);
+    if (interrupter)
+    {
+        interrupter->checkpoint();
+        interrupter->beginStage(0.5f, 1.0f);
+    }
+    if (!options.useBBox)
+    {
+        loadPointLOD(filename, gridName, reference->lod);
+        reference->levelSets.source = filename;
+    }
+    jobCheckpoint(interrupter, 1.0f);
+}
+
 SharedPointDataGridReference *readPointGridFromFile(const char *filename, const char *gridName, LoggingCallback cb)
+{
+    const PointGridOpenOptions options = defaultPointGridOpenOptions();
+    return readPointGridFromFileWithOptions(filename, gridName, &options, cb);
+}
+
+SharedPointDataGridReference *readPointGridFromFileWithOptions(const char *filename, const char *gridName,
+                                                               const PointGridOpenOptions *options, LoggingCallback cb)
 {
     SharedPointDataGridReference *reference = new SharedPointDataGridReference();
     try
@@ -129,7 +712,7 @@ SharedPointDataGridReference *readPointGridFromFile(const char *filename, const
         string grid(gridName);
         string message = "Reading PointDataGrid from " + filePath;
         cb(message.c_str());
-        reference->gridPtr = loadPointGrid(filePath, grid);
+        readPointGridInto(reference, filePath, grid, options ? *options : defaultPointGridOpenOptions(), nullptr);
     }
     catch (exception &e)
     {
@@ -138,56 +721,1212 @@ SharedPointDataGridReference *readPointGridFromFile(const char *filename, const
     return reference;
 }
 
+size_t getPointGridCacheSize()
+{
+    return PointGridCache::instance().size();
+}
+
 openvdb::Index64 getPointCountFromGrid(SharedPointDataGridReference *reference)
 {
     openvdb::Index64 count = pointCount(reference->gridPtr->tree());
     return count;
 }
-// TODO add quality modifier for createLevelSet
-void computeMeshFromPointGrid(SharedPointDataGridReference *reference, size_t &pointCount, size_t &triCount, LoggingCallback cb)
+/// Decode positions (world space) or a Vec3f attribute of every point and encode it into out,
+/// in parallel over leaves at their precomputed offsets.
+template <typename EncoderT>
+void exportPointAttribute(const PointDataGrid &grid, const vector<openvdb::Index64> &offsets, const string &attribute,
+                  PointBufferLayout layout, const EncoderT &encoder, typename EncoderT::StorageType *out)
 {
-    // https://github.com/AcademySoftwareFoundation/openvdb/blob/master/openvdb/viewer/RenderModules.cc (MeshOp)
-    string message = "Constructing Mesh from Point Grid. This Could Take a While";
-    cb(message.c_str());
-    MyParticleList pa;
-    PointDataGrid::Ptr grid = reference->gridPtr;
-    // put a check in using hasUniformVoxels
-    openvdb::Real voxelSize = grid->voxelSize().x();
-    for (auto leafIter = grid->tree().cbeginLeaf(); leafIter; ++leafIter)
-    {
-        const AttributeArray &positionArray = leafIter->constAttributeArray("P");
-        AttributeHandle<openvdb::Vec3f> positionHandle(positionArray);
-        for (auto indexIter = leafIter->beginIndexOn(); indexIter; ++indexIter)
+    typedef PointDataTree::LeafNodeType LeafT;
+    const size_t total = offsets.back();
+    const bool positions = attribute == "P";
+    const AffineIndexToWorld indexToWorld(grid.transform());
+    tbb::enumerable_thread_specific<vector<float>> scratch;
+    openvdb::tree::LeafManager<const PointDataTree> leafManager(grid.tree());
+    leafManager.foreach([&](const LeafT &leaf, size_t idx) {
+        const size_t begin = offsets[idx], count = offsets[idx + 1] - begin;
+        vector<float> &buffer = scratch.local();
+        buffer.resize(count * 3);
+        float *x = buffer.data(), *y = x + count, *z = y + count;
+        if (positions)
+        {
+            decodeLeafIndexPositions(leaf, x, y, z);
+            indexToWorld.apply(x, y, z, count);
+        }
+        else
         {
-            openvdb::Vec3f voxelPos = positionHandle.get(*indexIter);
-            openvdb::Vec3d xyz = indexIter.getCoord().asVec3d();
-            pa.add(grid->transform().indexToWorld(voxelPos + xyz), voxelSize);
+            decodeLeafVec3Attribute(leaf, leaf.attributeSet().find(attribute), x, y, z);
         }
+        writeEncodedComponents(x, y, z, count, begin, total, layout, encoder, out);
+    });
+}
+
+size_t exportPoints(SharedPointDataGridReference *reference, const string &attribute, void *out, size_t capacity,
+                    PointBufferLayout layout, PointBufferFormat format, const float *rangeMin, const float *rangeMax)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    ScopedPointMetricTimer timer(MetricExportPoints);
+    const PointDataGrid &grid = *reference->gridPtr;
+    const vector<openvdb::Index64> &offsets = reference->leafPointOffsets();
+    const size_t total = offsets.back();
+    if (capacity < total)
+        return 0;
+    if (attribute != "P")
+    {
+        auto leafIter = grid.tree().cbeginLeaf();
+        if (!leafIter || leafIter->attributeSet().find(attribute) == AttributeSet::INVALID_POS)
+            return 0;
     }
-    triCount = 0;
-    pointCount = 0;
-    openvdb::FloatGrid::Ptr floatGrid = openvdb::createLevelSet<openvdb::FloatGrid>(voxelSize / 2, voxelSize * 4);
-    openvdb::tools::ParticlesToLevelSet<openvdb::FloatGrid> raster(*floatGrid);
-    raster.setRmin(voxelSize);
-    raster.setGrainSize(1);
-    raster.rasterizeSpheres(pa);
-    raster.finalize();
-    floatGrid->setName("FloatGrid");
-    openvdb::FloatGrid::Ptr sampled = downsampleGrid<openvdb::FloatGrid>(floatGrid, SampleQuality::High);
-    openvdb::tools::VolumeToMesh mesher(0);
-    mesher(*sampled);
-    pointCount = mesher.pointListSize() * 3;
-    triCount = 0;
-    openvdb::tools::PolygonPoolList &polygonPoolList = mesher.polygonPoolList();
-    for (openvdb::Index64 i = 0, j = mesher.polygonPoolListSize(); i < j; ++i)
+    switch (format)
     {
-        triCount += polygonPoolList[i].numTriangles();
+    case Float32:
+        exportPointAttribute(grid, offsets, attribute, layout, Float32Encoder(), (float *)out);
+        break;
+    case Float16:
+        exportPointAttribute(grid, offsets, attribute, layout, Float16Encoder(), (uint16_t *)out);
+        break;
+    case UNorm16:
+        exportPointAttribute(grid, offsets, attribute, layout, UNormEncoder<uint16_t>(rangeMin, rangeMax), (uint16_t *)out);
+        break;
+    case UNorm8:
+        exportPointAttribute(grid, offsets, attribute, layout, UNormEncoder<uint8_t>(rangeMin, rangeMax), (uint8_t *)out);
+        break;
+    default:
+        return 0;
     }
-    message = "Total Vertices: " + to_string(pointCount) + "\n" + "Total Faces: " + to_string(triCount);
-    cb(message.c_str());
+    recordPointMetric(MetricPointsExported, total);
+    recordPointMetric(MetricLeavesTouched, offsets.size() - 1);
+    return total;
 }
 
-void destroySharedPointDataGridReference(SharedPointDataGridReference *reference)
+size_t getPointPositions(SharedPointDataGridReference *reference, float *positions, size_t capacity)
 {
-    delete reference;
+    return exportPoints(reference, "P", positions, capacity, Interleaved, Float32, nullptr, nullptr);
+}
+
+size_t getPointColors(SharedPointDataGridReference *reference, float *colors, size_t capacity)
+{
+    return exportPoints(reference, "Cd", colors, capacity, Interleaved, Float32, nullptr, nullptr);
+}
+
+size_t getPointPositionsEncoded(SharedPointDataGridReference *reference, void *positions, size_t capacity,
+                                PointBufferLayout layout, PointBufferFormat format, float *boundsMin, float *boundsMax)
+{
+    const openvdb::BBoxd bounds = computeWorldPointBounds(*reference->gridPtr);
+    float rangeMin[3], rangeMax[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        rangeMin[c] = float(bounds.min()[c]);
+        rangeMax[c] = float(bounds.max()[c]);
+        if (boundsMin)
+            boundsMin[c] = rangeMin[c];
+        if (boundsMax)
+            boundsMax[c] = rangeMax[c];
+    }
+    return exportPoints(reference, "P", positions, capacity, layout, format, rangeMin, rangeMax);
+}
+
+size_t getPointColorsEncoded(SharedPointDataGridReference *reference, void *colors, size_t capacity,
+                             PointBufferLayout layout, PointBufferFormat format)
+{
+    const float rangeMin[3] = {0.0f, 0.0f, 0.0f}, rangeMax[3] = {1.0f, 1.0f, 1.0f};
+    return exportPoints(reference, "Cd", colors, capacity, layout, format, rangeMin, rangeMax);
+}
+
+/// Write world positions of the points of visible leaves into out, up to capacity. Leaves that are
+/// fully inside are copied whole; leaves straddling a plane are filtered per point.
+size_t gatherVisiblePoints(SharedPointDataGridReference *reference, const vector<uint8_t> &flags,
+                           const vector<IndexPlane> &planes, float *out, size_t capacity)
+{
+    ScopedPointMetricTimer timer(MetricExportPoints);
+    const LeafBoundsTable &table = reference->leafBoundsTable();
+    const vector<openvdb::Index64> &offsets = reference->leafPointOffsets();
+    vector<uint32_t> visible;
+    for (size_t idx = 0; idx < flags.size(); ++idx)
+    {
+        if (flags[idx] != LeafOutside)
+            visible.push_back(uint32_t(idx));
+    }
+
+    const AffineIndexToWorld indexToWorld(reference->gridPtr->transform());
+    tbb::enumerable_thread_specific<vector<float>> scratch;
+    // decode a visible leaf to index space, keeping only points inside the planes; returns the count
+    auto decode = [&](uint32_t idx, vector<float> &buffer, float *&x, float *&y, float *&z) -> size_t {
+        const size_t count = offsets[idx + 1] - offsets[idx];
+        buffer.resize(count * 3);
+        x = buffer.data(), y = x + count, z = y + count;
+        decodeLeafIndexPositions(*table.leaves[idx], x, y, z);
+        if (flags[idx] == LeafInside)
+            return count;
+        size_t kept = 0;
+        for (size_t n = 0; n < count; ++n)
+        {
+            if (!insidePlanes(planes, x[n], y[n], z[n]))
+                continue;
+            x[kept] = x[n], y[kept] = y[n], z[kept] = z[n];
+            ++kept;
+        }
+        return kept;
+    };
+
+    vector<size_t> counts(visible.size() + 1, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, visible.size()), [&](const tbb::blocked_range<size_t> &range) {
+        float *x, *y, *z;
+        for (size_t i = range.begin(); i < range.end(); ++i)
+        {
+            const uint32_t idx = visible[i];
+            counts[i + 1] = flags[idx] == LeafInside ? size_t(offsets[idx + 1] - offsets[idx])
+                                                     : decode(idx, scratch.local(), x, y, z);
+        }
+    });
+    for (size_t i = 1; i < counts.size(); ++i)
+        counts[i] += counts[i - 1];
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, visible.size()), [&](const tbb::blocked_range<size_t> &range) {
+        float *x, *y, *z;
+        for (size_t i = range.begin(); i < range.end(); ++i)
+        {
+            const size_t begin = counts[i];
+            if (begin >= capacity)
+                continue;
+            const size_t count = min(decode(visible[i], scratch.local(), x, y, z), capacity - begin);
+            indexToWorld.apply(x, y, z, count);
+            writeEncodedComponents(x, y, z, count, begin, capacity, Interleaved, Float32Encoder(), out);
+        }
+    });
+    recordPointMetric(MetricPointsExported, min(counts.back(), capacity));
+    recordPointMetric(MetricLeavesTouched, visible.size());
+    return counts.back();
+}
+
+size_t cullLeaves(SharedPointDataGridReference *reference, const vector<IndexPlane> &planes, vector<uint8_t> &flags)
+{
+    ScopedPointMetricTimer timer(MetricCull);
+    const LeafBoundsTable &table = reference->leafBoundsTable();
+    flags.resize(table.size());
+    classifyLeaves(table, planes, nullptr, 0, table.size(), flags.data(), nullptr);
+    recordPointMetric(MetricLeavesTouched, table.size());
+    return flags.size();
+}
+
+size_t cullLeavesFrustum(SharedPointDataGridReference *reference, const float *planes, uint32_t *leafIds, size_t capacity)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    vector<uint8_t> flags;
+    cullLeaves(reference, worldToIndexPlanes(planes, 6, reference->gridPtr->transform()), flags);
+    return compactVisibleLeaves(flags, leafIds, capacity);
+}
+
+size_t cullLeavesBox(SharedPointDataGridReference *reference, const float *boxMin, const float *boxMax, uint32_t *leafIds, size_t capacity)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    vector<uint8_t> flags;
+    cullLeaves(reference, worldBoxToIndexPlanes(boxMin, boxMax, reference->gridPtr->transform()), flags);
+    return compactVisibleLeaves(flags, leafIds, capacity);
+}
+
+size_t cullPointsFrustum(SharedPointDataGridReference *reference, const float *planes, float *positions, size_t capacity)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    vector<uint8_t> flags;
+    const vector<IndexPlane> indexPlanes = worldToIndexPlanes(planes, 6, reference->gridPtr->transform());
+    cullLeaves(reference, indexPlanes, flags);
+    return gatherVisiblePoints(reference, flags, indexPlanes, positions, capacity);
+}
+
+size_t cullPointsBox(SharedPointDataGridReference *reference, const float *boxMin, const float *boxMax, float *positions, size_t capacity)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    vector<uint8_t> flags;
+    const vector<IndexPlane> indexPlanes = worldBoxToIndexPlanes(boxMin, boxMax, reference->gridPtr->transform());
+    cullLeaves(reference, indexPlanes, flags);
+    return gatherVisiblePoints(reference, flags, indexPlanes, positions, capacity);
+}
+
+FrustumCullHandle *createFrustumCullState(SharedPointDataGridReference *reference)
+{
+    return new FrustumCullHandle(reference->gridPtr->transformPtr(), reference, reference->leafBoundsTable());
+}
+
+size_t cullLeavesFrustumIncremental(FrustumCullHandle *handle, const float *planes, uint32_t *leafIds, size_t capacity)
+{
+    ScopedPointMetricTimer timer(MetricCull);
+    // rebuilds the table the state tests if points were appended since
+    handle->reference->leafBoundsTable();
+    handle->state.update(worldToIndexPlanes(planes, 6, *handle->transform));
+    return compactVisibleLeaves(handle->state.flags(), leafIds, capacity);
+}
+
+size_t cullPointsFrustumIncremental(SharedPointDataGridReference *reference, FrustumCullHandle *handle, const float *planes, float *positions, size_t capacity)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    const vector<IndexPlane> indexPlanes = worldToIndexPlanes(planes, 6, *handle->transform);
+    {
+        ScopedPointMetricTimer timer(MetricCull);
+        // rebuilds the table the state tests if points were appended since
+        reference->leafBoundsTable();
+        handle->state.update(indexPlanes);
+    }
+    return gatherVisiblePoints(reference, handle->state.flags(), indexPlanes, positions, capacity);
+}
+
+void destroyFrustumCullState(FrustumCullHandle *handle)
+{
+    delete handle;
+}
+
+int buildPointLOD(SharedPointDataGridReference *reference, int levelCount, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        ScopedPointMetricTimer timer(MetricBuildLOD);
+        reference->lod.build(*reference->gridPtr, levelCount);
+        string message = "Built " + to_string(reference->lod.levels.size()) + " LOD levels";
+        cb(message.c_str());
+        return int(reference->lod.levels.size());
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return 0;
+    }
+}
+
+float computeLODWorldError(float pixelError, float distance, float verticalFovRadians, float screenHeightPixels)
+{
+    return pixelError * 2.0f * distance * tan(0.5f * verticalFovRadians) / screenHeightPixels;
+}
+
+size_t queryPointLOD(SharedPointDataGridReference *reference, size_t pointBudget, float maxWorldError,
+                     float *positions, float *colors, size_t capacity, int *level)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    const vector<openvdb::Index64> &offsets = reference->leafPointOffsets();
+    const PointLODPyramid &lod = reference->lod;
+    int selected = lod.selectLevel(offsets.back(), min(pointBudget, capacity), maxWorldError);
+    if (level)
+        *level = selected;
+    // the budget may pick the coarsest level even when it doesn't fit
+    if ((selected < 0 ? size_t(offsets.back()) : lod.levels[selected].size()) > capacity)
+        return 0;
+    if (selected < 0)
+    {
+        exportPoints(reference, "P", positions, capacity, Interleaved, Float32, nullptr, nullptr);
+        if (colors)
+            exportPoints(reference, "Cd", colors, capacity, Interleaved, Float32, nullptr, nullptr);
+        return offsets.back();
+    }
+    const PointLODLevel &points = lod.levels[selected];
+    const size_t count = points.size();
+    const bool copyColors = colors && !points.colors.empty();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, count, 1 << 14), [&](const tbb::blocked_range<size_t> &range) {
+        memcpy(positions + range.begin() * 3, &points.positions[range.begin()], range.size() * sizeof(openvdb::Vec3f));
+        if (copyColors)
+            memcpy(colors + range.begin() * 3, &points.colors[range.begin()], range.size() * sizeof(openvdb::Vec3f));
+    });
+    return points.size();
+}
+
+/// Point queries measure distances in index space scaled by the voxel size, so they need a linear
+/// transform with the same scale on every axis.
+static bool queryableTransform(const openvdb::math::Transform &transform)
+{
+    return transform.isLinear() && transform.hasUniformScale();
+}
+
+bool pickPointAlongRay(SharedPointDataGridReference *reference, const float *origin, const float *direction, float radius,
+                       float maxDistance, PointQueryHit *hit)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    if (!queryableTransform(reference->gridPtr->transform()))
+        return false;
+    ScopedPointMetricTimer timer(MetricPointQuery);
+    PointQuery query(*reference->gridPtr, reference->pointQueryIndex());
+    return query.pick(openvdb::Vec3d(origin[0], origin[1], origin[2]), openvdb::Vec3d(direction[0], direction[1], direction[2]),
+                      radius, maxDistance, *hit);
+}
+
+size_t queryNearestPoints(SharedPointDataGridReference *reference, const float *position, size_t k, float maxDistance,
+                          PointQueryHit *hits)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    if (!queryableTransform(reference->gridPtr->transform()))
+        return 0;
+    ScopedPointMetricTimer timer(MetricPointQuery);
+    PointQuery query(*reference->gridPtr, reference->pointQueryIndex());
+    vector<PointQueryHit> found;
+    query.nearest(openvdb::Vec3d(position[0], position[1], position[2]), k, maxDistance, found);
+    copy(found.begin(), found.end(), hits);
+    return found.size();
+}
+
+size_t queryPointsInRadius(SharedPointDataGridReference *reference, const float *position, float radius,
+                           PointQueryHit *hits, size_t capacity)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    if (!queryableTransform(reference->gridPtr->transform()))
+        return 0;
+    ScopedPointMetricTimer timer(MetricPointQuery);
+    PointQuery query(*reference->gridPtr, reference->pointQueryIndex());
+    vector<PointQueryHit> found;
+    query.sphere(openvdb::Vec3d(position[0], position[1], position[2]), radius, found);
+    copy(found.begin(), found.begin() + min(found.size(), capacity), hits);
+    return found.size();
+}
+
+/// Each ParticlesToLevelSet task rasterizes into its own grid that is unioned on join, so split
+/// into a few tasks per thread rather than per particle.
+size_t rasterGrainSize(size_t particleCount)
+{
+    const size_t tasks = 4 * size_t(max(1, tbb::this_task_arena::max_concurrency()));
+    return max<size_t>(particleCount / tasks, 1024);
+}
+
+// ParticlesToLevelSet skips spheres smaller than this many raster voxels
+static const double MESH_MIN_RADIUS_VOXELS = 1.5;
+
+/// Raster voxel size for a quality, relative to the point grid's voxel size: High rasterizes at half
+/// the point voxel size, Medium at the point voxel size and Low at twice it.
+double meshVoxelSize(double pointVoxelSize, SampleQuality quality)
+{
+    switch (quality)
+    {
+    case Low:
+        return pointVoxelSize * 2.0;
+    case Medium:
+        return pointVoxelSize;
+    default:
+        return pointVoxelSize * 0.5;
+    }
+}
+
+/// World radius of the sphere around each point. A point voxel closes the gaps between neighbours;
+/// coarse rasters need larger spheres to stay above the minimum radius.
+double meshParticleRadius(double pointVoxelSize, double rasterVoxelSize)
+{
+    return max(pointVoxelSize, MESH_MIN_RADIUS_VOXELS * rasterVoxelSize);
+}
+
+/// Rasterize particles straight into a level set of rasterVoxelSize with the default half width.
+openvdb::FloatGrid::Ptr rasterizePointGrid(const PointDataParticleList &particles, double rasterVoxelSize, JobInterrupter *interrupter)
+{
+    ScopedPointMetricTimer timer(MetricRasterize);
+    openvdb::FloatGrid::Ptr floatGrid = openvdb::createLevelSet<openvdb::FloatGrid>(rasterVoxelSize);
+    openvdb::tools::ParticlesToLevelSet<openvdb::FloatGrid, void, JobInterrupter> raster(*floatGrid, interrupter);
+    raster.setRmin(MESH_MIN_RADIUS_VOXELS);
+    raster.setGrainSize(rasterGrainSize(particles.size()));
+    raster.rasterizeSpheres(particles);
+    raster.finalize();
+    floatGrid->setName("FloatGrid");
+    return floatGrid;
+}
+
+void meshLevelSet(const openvdb::FloatGrid &levelSet, const PointMeshOptions &options, MeshData &mesh)
+{
+    ScopedPointMetricTimer timer(MetricVolumeToMesh);
+    openvdb::tools::VolumeToMesh mesher(options.isoValue, options.adaptivity);
+    mesher(levelSet);
+    mesh.take(mesher);
+}
+
+static const char *sampleQualityName(SampleQuality quality)
+{
+    switch (quality)
+    {
+    case Low:
+        return "Low";
+    case Medium:
+        return "Medium";
+    default:
+        return "High";
+    }
+}
+
+/// Name a level set of a point grid is stored under, e.g. Points_SDF_High.
+string levelSetGridName(const string &pointGridName, SampleQuality quality)
+{
+    return pointGridName + "_SDF_" + sampleQualityName(quality);
+}
+
+/// Gather and rasterize every point of grid at the resolution quality asks for. The level set is
+/// named after the point grid and tagged with its radius, see levelSetMatches.
+/// With an interrupter, progress runs to 0.7 and JobCancelledError is thrown once cancelled, so a
+/// returned level set is always complete.
+openvdb::FloatGrid::Ptr rasterizePointGridLevelSet(const PointDataGrid &grid, SampleQuality quality, JobInterrupter *interrupter)
+{
+    // put a check in using hasUniformVoxels
+    const openvdb::Real pointVoxelSize = grid.voxelSize().x();
+    const openvdb::Real rasterVoxelSize = meshVoxelSize(pointVoxelSize, quality);
+    const openvdb::Real radius = meshParticleRadius(pointVoxelSize, rasterVoxelSize);
+    unique_ptr<PointDataParticleList> pa;
+    {
+        ScopedPointMetricTimer timer(MetricGatherPoints);
+        pa.reset(new PointDataParticleList(grid, radius));
+        recordPointMetric(MetricPointsGathered, pa->size());
+        recordPointMetric(MetricLeavesTouched, grid.tree().leafCount());
+    }
+    jobCheckpoint(interrupter, 0.1f);
+    openvdb::FloatGrid::Ptr floatGrid = rasterizePointGrid(*pa, rasterVoxelSize, interrupter);
+    recordPointMetricPeak(MetricPeakTrackedBytes, floatGrid->memUsage() + pa->size() * 3 * sizeof(float));
+    jobCheckpoint(interrupter, 0.7f);
+    floatGrid->setName(levelSetGridName(grid.getName(), quality));
+    tagLevelSet(*floatGrid, radius);
+    return floatGrid;
+}
+
+/// Polygonize levelSet into mesh. VolumeToMesh has no interrupter hook and is stopped by the job's
+/// task group instead, then caught by the checkpoint after it.
+static void meshPointLevelSet(const openvdb::FloatGrid &levelSet, const PointMeshOptions &options, MeshData &mesh, JobInterrupter *interrupter)
+{
+    MeshData result;
+    meshLevelSet(levelSet, options, result);
+    jobCheckpoint(interrupter, 1.0f);
+    swap(mesh, result);
+    recordPointMetric(MetricMeshVertices, mesh.pointCount);
+    recordPointMetric(MetricMeshTriangles, mesh.triangleCount());
+    recordPointMetricPeak(MetricPeakTrackedBytes, levelSet.memUsage() + mesh.pointCount * sizeof(openvdb::Vec3s) +
+                                                      mesh.triangleCount() * sizeof(openvdb::Vec3I));
+}
+
+/// Rasterize the points to a level set at the resolution options.quality asks for and mesh it into
+/// mesh. With an interrupter, progress is reported per step and JobCancelledError is thrown once
+/// cancelled.
+void buildPointGridMesh(const PointDataGrid &grid, const PointMeshOptions &options, MeshData &mesh, JobInterrupter *interrupter)
+{
+    openvdb::FloatGrid::Ptr levelSet = rasterizePointGridLevelSet(grid, options.quality, interrupter);
+    meshPointLevelSet(*levelSet, options, mesh, interrupter);
+}
+
+/// Read the level set stored as name in filename if it was rasterized with these parameters from
+/// the same points. Only the metadata is read for one that doesn't match.
+openvdb::FloatGrid::Ptr readMatchingLevelSet(const string &filename, const string &name, double voxelSize, double radius,
+                                             const PointGridIdentity &points)
+{
+    ScopedPointMetricTimer timer(MetricLoadGrid);
+    openvdb::io::File file(filename);
+    file.open();
+    openvdb::FloatGrid::Ptr levelSet;
+    if (file.hasGrid(name) && levelSetMatches(*file.readGridMetadata(name), voxelSize, radius, points))
+        levelSet = openvdb::gridPtrCast<openvdb::FloatGrid>(file.readGrid(name));
+    file.close();
+    return levelSet;
+}
+
+/// The reference's level set for quality: from its cache, else from the file its points were read
+/// from, else rasterized. Either way it is cached for the next mesh.
+openvdb::FloatGrid::Ptr pointGridLevelSet(SharedPointDataGridReference *reference, SampleQuality quality, JobInterrupter *interrupter)
+{
+    const PointDataGrid &grid = *reference->gridPtr;
+    const double pointVoxelSize = grid.voxelSize().x();
+    const double rasterVoxelSize = meshVoxelSize(pointVoxelSize, quality);
+    const double radius = meshParticleRadius(pointVoxelSize, rasterVoxelSize);
+    LevelSetCache &cache = reference->levelSets;
+    openvdb::FloatGrid::Ptr levelSet = cache.find(rasterVoxelSize, radius);
+    if (levelSet)
+    {
+        recordPointMetric(MetricLevelSetCacheHits, 1);
+        return levelSet;
+    }
+    if (!cache.source.empty())
+    {
+        try
+        {
+            levelSet = readMatchingLevelSet(cache.source, levelSetGridName(grid.getName(), quality), rasterVoxelSize, radius,
+                                            reference->pointIdentity());
+        }
+        catch (openvdb::IoError &)
+        {
+            // the file moved or changed since the points were read; rasterize instead
+            cache.source.clear();
+        }
+    }
+    if (levelSet)
+        recordPointMetric(MetricLevelSetCacheHits, 1);
+    else
+        levelSet = rasterizePointGridLevelSet(grid, quality, interrupter);
+    cache.insert(rasterVoxelSize, radius, levelSet);
+    return levelSet;
+}
+
+/// buildPointGridMesh through the reference's level set cache.
+void buildReferenceMesh(SharedPointDataGridReference *reference, const PointMeshOptions &options, MeshData &mesh, JobInterrupter *interrupter)
+{
+    openvdb::FloatGrid::Ptr levelSet = pointGridLevelSet(reference, options.quality, interrupter);
+    jobCheckpoint(interrupter, 0.7f);
+    meshPointLevelSet(*levelSet, options, mesh, interrupter);
+}
+
+void computeMeshFromPointGrid(SharedPointDataGridReference *reference, size_t &pointCount, size_t &triCount, LoggingCallback cb)
+{
+    const PointMeshOptions options = defaultPointMeshOptions();
+    computeMeshFromPointGridWithOptions(reference, &options, pointCount, triCount, cb);
+}
+
+void computeMeshFromPointGridWithOptions(SharedPointDataGridReference *reference, const PointMeshOptions *options,
+                                         size_t &pointCount, size_t &triCount, LoggingCallback cb)
+{
+    // https://github.com/AcademySoftwareFoundation/openvdb/blob/master/openvdb/viewer/RenderModules.cc (MeshOp)
+    PointMetricsScope metricsScope(&reference->metrics);
+    string message = "Constructing Mesh from Point Grid. This Could Take a While";
+    cb(message.c_str());
+    triCount = 0;
+    pointCount = 0;
+    buildReferenceMesh(reference, options ? *options : defaultPointMeshOptions(), reference->mesh, nullptr);
+    pointCount = reference->mesh.pointCount;
+    triCount = reference->mesh.triangleCount();
+    message = "Total Vertices: " + to_string(pointCount) + "\n" + "Total Faces: " + to_string(triCount);
+    cb(message.c_str());
+}
+
+bool getMeshVertices(SharedPointDataGridReference *reference, float *vertices, size_t capacity)
+{
+    if (capacity < reference->mesh.pointCount)
+        return false;
+    reference->mesh.copyVertices(vertices);
+    return true;
+}
+
+bool getMeshNormals(SharedPointDataGridReference *reference, float *normals, size_t capacity)
+{
+    if (capacity < reference->mesh.pointCount)
+        return false;
+    reference->mesh.computeNormals(normals);
+    return true;
+}
+
+bool getMeshTriangles(SharedPointDataGridReference *reference, uint32_t *indices, size_t capacity)
+{
+    if (capacity < reference->mesh.triangleCount())
+        return false;
+    reference->mesh.copyTriangles(indices);
+    return true;
+}
+
+// Incremental updates ----------------------------------------------------------------------
+
+/// Codecs of a grid's "P" and "Cd", so points appended to it get the same attribute layout.
+/// Other attributes are left to appendCloudToPointGrid.
+PointConversionOptions pointGridConversionOptions(const PointDataGrid &grid)
+{
+    PointConversionOptions options = defaultPointConversionOptions();
+    PointDataTree::LeafCIter leaf = grid.tree().cbeginLeaf();
+    if (!leaf)
+        return options;
+    const AttributeSet::Descriptor &descriptor = leaf->attributeSet().descriptor();
+    const openvdb::Name vec3f = openvdb::typeNameAsString<openvdb::Vec3f>();
+    for (const auto &entry : descriptor.map())
+    {
+        const openvdb::NamePair &type = descriptor.type(entry.second);
+        if (entry.first == "P" && type.first == vec3f)
+        {
+            if (type.second == FixedPointCodec<false>::name())
+                options.positionCodec = PositionFixed16;
+            else if (type.second == FixedPointCodec<true>::name())
+                options.positionCodec = PositionFixed8;
+            else if (type.second == TruncateCodec::name())
+                options.positionCodec = PositionHalf;
+            else if (type.second != NullCodec::name())
+                throw runtime_error("Can't append to positions stored with codec " + type.second);
+        }
+        else if (entry.first == "Cd" && type.first == vec3f)
+        {
+            if (type.second == FixedPointCodec<true, UnitRange>::name())
+                options.colorCodec = ColorUnitRange8;
+            else if (type.second != FixedPointCodec<false, UnitRange>::name())
+                throw runtime_error("Can't append to colors stored with codec " + type.second);
+        }
+        else if (entry.first == "P" || entry.first == "Cd")
+            throw runtime_error("Can't append to " + entry.first + " stored as " + type.first);
+    }
+    return options;
+}
+
+/// Merge the points of batch into grid, with its transform and attribute layout, and return the
+/// origins of the leaves that gained points. Colors are dropped if the grid has none and filled
+/// with black if the batch has none. The cost is that of the batch and the leaves it lands in.
+vector<openvdb::Coord> appendCloudToPointGrid(PointDataGrid &grid, PLYReader::PointData<float, uint8_t> &batch)
+{
+    ScopedPointMetricTimer timer(MetricAppendPoints);
+    const PointConversionOptions options = pointGridConversionOptions(grid);
+    PointDataTree::LeafCIter leaf = grid.tree().cbeginLeaf();
+    if (leaf && !leaf->hasAttribute("Cd"))
+        batch.color.clear();
+    else if (leaf && batch.color.empty())
+        batch.color.resize(batch.vertices.size(), PLYReader::rgb<uint8_t>{0, 0, 0});
+    PointDataGrid::Ptr partial = createPointDataGridFromCloud(batch, grid.transform(), options);
+    if (leaf && partial->tree().leafCount() > 0)
+    {
+        // attributes the batch has no values for, such as normals, get their defaults, in the
+        // grid's order so the leaves share its descriptor
+        const AttributeSet::Descriptor &descriptor = leaf->attributeSet().descriptor();
+        vector<openvdb::Name> names(descriptor.size());
+        for (const auto &entry : descriptor.map())
+            names[entry.second] = entry.first;
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (partial->tree().cbeginLeaf()->hasAttribute(names[i]))
+                continue;
+            const AttributeArray &array = leaf->constAttributeArray(i);
+            appendAttribute(partial->tree(), names[i], descriptor.type(i), array.stride(), array.hasConstantStride());
+        }
+    }
+    vector<openvdb::Coord> origins;
+    origins.reserve(partial->tree().leafCount());
+    for (PointDataTree::LeafCIter iter = partial->tree().cbeginLeaf(); iter; ++iter)
+        origins.push_back(iter->origin());
+    mergePointDataGrids(grid, *partial);
+    return origins;
+}
+
+/// Point voxels around a region whose points can change its polygons: the sphere radius and the
+/// narrow band, plus a voxel for points sitting off their voxel centre and for polygon extent.
+static int regionHaloVoxels(double pointVoxelSize, double rasterVoxelSize)
+{
+    const double halo = meshParticleRadius(pointVoxelSize, rasterVoxelSize) + (openvdb::LEVEL_SET_HALF_WIDTH + 1) * rasterVoxelSize;
+    return int(ceil(halo / pointVoxelSize)) + 1;
+}
+
+/// Rasterize the points of a region and its halo, mesh them and keep the region's polygons.
+static void meshRegion(const PointDataGrid &grid, const openvdb::Coord &key, int halo, double rasterVoxelSize,
+                       const PointMeshOptions &options, RegionMesh &out)
+{
+    typedef PointDataTree::LeafNodeType LeafT;
+    openvdb::CoordBBox voxels = regionVoxelBounds(key);
+    voxels.expand(halo);
+    const int mask = ~int(LeafT::DIM - 1);
+    const openvdb::Coord lo(voxels.min().x() & mask, voxels.min().y() & mask, voxels.min().z() & mask);
+    vector<const LeafT *> leaves;
+    openvdb::tree::ValueAccessor<const PointDataTree> accessor(grid.tree());
+    for (int i = lo.x(); i <= voxels.max().x(); i += LeafT::DIM)
+        for (int j = lo.y(); j <= voxels.max().y(); j += LeafT::DIM)
+            for (int k = lo.z(); k <= voxels.max().z(); k += LeafT::DIM)
+            {
+                const LeafT *leaf = accessor.probeConstLeaf(openvdb::Coord(i, j, k));
+                if (leaf && leaf->onPointCount() > 0)
+                    leaves.push_back(leaf);
+            }
+    out = RegionMesh();
+    if (leaves.empty())
+        return;
+    unique_ptr<PointDataParticleList> particles;
+    {
+        ScopedPointMetricTimer timer(MetricGatherPoints);
+        particles.reset(new PointDataParticleList(grid, leaves, meshParticleRadius(grid.voxelSize().x(), rasterVoxelSize)));
+        recordPointMetric(MetricPointsGathered, particles->size());
+        recordPointMetric(MetricLeavesTouched, leaves.size());
+    }
+    openvdb::FloatGrid::Ptr levelSet = rasterizePointGrid(*particles, rasterVoxelSize, nullptr);
+    particles.reset();
+    MeshData mesh;
+    meshLevelSet(*levelSet, options, mesh);
+    out.extract(mesh, grid.transform(), key);
+}
+
+/// Remember the parameters regions were meshed with and that dirty leaves are accounted for.
+static void finishRegionMesh(RegionMeshSet &regions, double rasterVoxelSize, const PointMeshOptions &options)
+{
+    regions.dirtyLeaves.clear();
+    regions.built = true;
+    regions.rasterVoxelSize = rasterVoxelSize;
+    regions.isoValue = options.isoValue;
+    recordPointMetric(MetricRegionsMeshed, regions.delta.size());
+}
+
+/// Remesh the regions within reach of regions.dirtyLeaves, in parallel over regions. When the
+/// raster parameters differ from the ones the regions were built with, the whole grid is meshed
+/// once instead, from levelSet if given, and split into regions. The keys of the regions replaced
+/// or emptied become regions.delta. Cancelling leaves regions as they were. Adaptivity is ignored:
+/// adaptive polygons of a region and its halo don't match the ones its neighbours were meshed with,
+/// so regions are always meshed at adaptivity 0 to keep their borders closed.
+size_t remeshRegions(const PointDataGrid &grid, const PointMeshOptions &meshOptions, RegionMeshSet &regions,
+                     const openvdb::FloatGrid *levelSet, JobInterrupter *interrupter)
+{
+    typedef PointDataTree::LeafNodeType LeafT;
+    ScopedPointMetricTimer timer(MetricRemeshRegions);
+    PointMeshOptions options = meshOptions;
+    options.adaptivity = 0.0f;
+    const double pointVoxelSize = grid.voxelSize().x();
+    const double rasterVoxelSize = meshVoxelSize(pointVoxelSize, options.quality);
+
+    if (!regions.matches(rasterVoxelSize, options.isoValue))
+    {
+        openvdb::FloatGrid::Ptr rasterized;
+        if (!levelSet)
+        {
+            rasterized = rasterizePointGridLevelSet(grid, options.quality, interrupter);
+            levelSet = rasterized.get();
+        }
+        MeshData mesh;
+        meshPointLevelSet(*levelSet, options, mesh, interrupter);
+        map<openvdb::Coord, RegionMesh> meshes;
+        splitMeshIntoRegions(mesh, grid.transform(), meshes);
+        // existing regions are part of the delta so the ones left without triangles are dropped
+        set<openvdb::Coord> keys;
+        for (const auto &region : regions.regions)
+            keys.insert(region.first);
+        for (const auto &region : meshes)
+            keys.insert(region.first);
+        regions.regions.swap(meshes);
+        regions.delta.assign(keys.begin(), keys.end());
+        finishRegionMesh(regions, rasterVoxelSize, options);
+        return regions.delta.size();
+    }
+
+    const int halo = regionHaloVoxels(pointVoxelSize, rasterVoxelSize);
+    set<openvdb::Coord> keys;
+    for (const openvdb::Coord &origin : regions.dirtyLeaves)
+    {
+        openvdb::CoordBBox voxels(origin, origin.offsetBy(LeafT::DIM - 1));
+        voxels.expand(halo);
+        addRegionKeys(voxels, keys);
+    }
+    vector<openvdb::Coord> delta(keys.begin(), keys.end());
+    vector<RegionMesh> meshes(delta.size());
+    PointMetrics *metrics = currentPointMetrics();
+    atomic<size_t> done(0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, delta.size(), 1), [&](const tbb::blocked_range<size_t> &range) {
+        PointMetricsScope metricsScope(metrics);
+        for (size_t i = range.begin(); i < range.end(); ++i)
+        {
+            if (interrupter && interrupter->cancelled())
+                return;
+            meshRegion(grid, delta[i], halo, rasterVoxelSize, options, meshes[i]);
+            if (interrupter)
+                interrupter->setStageProgress(float(++done) / float(delta.size()));
+        }
+    });
+    jobCheckpoint(interrupter, 1.0f);
+
+    for (size_t i = 0; i < delta.size(); ++i)
+    {
+        if (meshes[i].empty())
+            regions.regions.erase(delta[i]);
+        else
+            swap(regions.regions[delta[i]], meshes[i]);
+    }
+    regions.delta.swap(delta);
+    finishRegionMesh(regions, rasterVoxelSize, options);
+    return regions.delta.size();
+}
+
+bool appendPointsToGrid(SharedPointDataGridReference *reference, const float *positions, const uint8_t *colors,
+                        size_t count, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        if (count == 0)
+            return true;
+        PLYReader::PointData<float, uint8_t> batch;
+        batch.vertices.resize(count);
+        memcpy(batch.vertices.data(), positions, count * 3 * sizeof(float));
+        if (colors)
+        {
+            batch.color.resize(count);
+            memcpy(batch.color.data(), colors, count * 3);
+        }
+        // the cache only holds weak pointers, so a grid it still hands out can look unique: unpublish it
+        // first, then copy it if other references hold it, since they must not see the new points
+        PointGridCache::instance().forget(*reference->gridPtr);
+        if (reference->gridPtr.use_count() != 1)
+            reference->gridPtr = reference->gridPtr->deepCopy();
+        const vector<openvdb::Coord> origins = appendCloudToPointGrid(*reference->gridPtr, batch);
+        reference->regionMeshes.dirtyLeaves.insert(origins.begin(), origins.end());
+        // per leaf tables are emptied and rebuilt on next use, so an append costs the batch, not the
+        // scene; cull states hold on to the bounds table, so it is emptied in place rather than dropped
+        reference->leafOffsets.clear();
+        reference->leafBounds.clear();
+        reference->queryIndex.clear();
+        reference->lod.clear();
+        reference->levelSets.clear();
+        reference->identity = PointGridIdentity();
+        string message = "Appended " + to_string(count) + " points to " + to_string(origins.size()) + " leaves";
+        cb(message.c_str());
+        return true;
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return false;
+    }
+}
+
+size_t remeshPointGridRegions(SharedPointDataGridReference *reference, const PointMeshOptions *options, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        const PointMeshOptions meshOptions = options ? *options : defaultPointMeshOptions();
+        const PointDataGrid &grid = *reference->gridPtr;
+        // a full build meshes the cached level set once; updates rasterize only their regions
+        openvdb::FloatGrid::Ptr levelSet;
+        if (!reference->regionMeshes.matches(meshVoxelSize(grid.voxelSize().x(), meshOptions.quality), meshOptions.isoValue))
+            levelSet = pointGridLevelSet(reference, meshOptions.quality, nullptr);
+        const size_t changed = remeshRegions(grid, meshOptions, reference->regionMeshes, levelSet.get(), nullptr);
+        string message = "Remeshed " + to_string(changed) + " of " + to_string(reference->regionMeshes.regions.size()) + " regions";
+        cb(message.c_str());
+        return changed;
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return 0;
+    }
+}
+
+size_t getRegionMeshDelta(SharedPointDataGridReference *reference, int32_t *keys, size_t capacity)
+{
+    const vector<openvdb::Coord> &delta = reference->regionMeshes.delta;
+    for (size_t i = 0; i < delta.size() && i < capacity; ++i)
+    {
+        keys[i * 3] = delta[i].x();
+        keys[i * 3 + 1] = delta[i].y();
+        keys[i * 3 + 2] = delta[i].z();
+    }
+    return delta.size();
+}
+
+static const RegionMesh *findRegionMesh(SharedPointDataGridReference *reference, const int32_t *key)
+{
+    return reference->regionMeshes.find(openvdb::Coord(key[0], key[1], key[2]));
+}
+
+bool getRegionMeshCounts(SharedPointDataGridReference *reference, const int32_t *key, size_t &pointCount, size_t &triCount)
+{
+    const RegionMesh *mesh = findRegionMesh(reference, key);
+    pointCount = mesh ? mesh->vertices.size() : 0;
+    triCount = mesh ? mesh->triangles.size() : 0;
+    return mesh != nullptr;
+}
+
+bool getRegionMeshVertices(SharedPointDataGridReference *reference, const int32_t *key, float *vertices, size_t capacity)
+{
+    const RegionMesh *mesh = findRegionMesh(reference, key);
+    if (!mesh || capacity < mesh->vertices.size())
+        return false;
+    mesh->copyVertices(vertices);
+    return true;
+}
+
+bool getRegionMeshNormals(SharedPointDataGridReference *reference, const int32_t *key, float *normals, size_t capacity)
+{
+    const RegionMesh *mesh = findRegionMesh(reference, key);
+    if (!mesh || capacity < mesh->vertices.size())
+        return false;
+    mesh->computeNormals(normals);
+    return true;
+}
+
+bool getRegionMeshTriangles(SharedPointDataGridReference *reference, const int32_t *key, uint32_t *indices, size_t capacity)
+{
+    const RegionMesh *mesh = findRegionMesh(reference, key);
+    if (!mesh || capacity < mesh->triangles.size())
+        return false;
+    mesh->copyTriangles(indices);
+    return true;
+}
+
+bool cachePointGridLevelSet(SharedPointDataGridReference *reference, SampleQuality quality, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        pointGridLevelSet(reference, quality, nullptr);
+        return true;
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return false;
+    }
+}
+
+bool writePointGridLevelSets(SharedPointDataGridReference *reference, const char *filename, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        openvdb::GridPtrVec grids;
+        reference->levelSets.grids(grids);
+        if (grids.empty())
+        {
+            cb("No level sets cached to write");
+            return false;
+        }
+        for (const openvdb::GridBase::Ptr &levelSet : grids)
+            tagLevelSetPoints(*levelSet, reference->pointIdentity());
+        writePointGrids(filename, grids, FileCompressionDefault, nullptr);
+        string message = "Wrote " + to_string(grids.size()) + " level sets to " + string(filename);
+        cb(message.c_str());
+        return true;
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return false;
+    }
+}
+
+int readPointGridLevelSets(SharedPointDataGridReference *reference, const char *filename, LoggingCallback cb)
+{
+    PointMetricsScope metricsScope(&reference->metrics);
+    try
+    {
+        const PointDataGrid &grid = *reference->gridPtr;
+        const double pointVoxelSize = grid.voxelSize().x();
+        const PointGridIdentity &points = reference->pointIdentity();
+        const SampleQuality qualities[] = {High, Medium, Low};
+        int loaded = 0;
+        for (SampleQuality quality : qualities)
+        {
+            const double rasterVoxelSize = meshVoxelSize(pointVoxelSize, quality);
+            const double radius = meshParticleRadius(pointVoxelSize, rasterVoxelSize);
+            openvdb::FloatGrid::Ptr levelSet = readMatchingLevelSet(filename, levelSetGridName(grid.getName(), quality),
+                                                                    rasterVoxelSize, radius, points);
+            if (!levelSet)
+                continue;
+            reference->levelSets.insert(rasterVoxelSize, radius, levelSet);
+            ++loaded;
+        }
+        string message = "Read " + to_string(loaded) + " level sets from " + string(filename);
+        cb(message.c_str());
+        return loaded;
+    }
+    catch (exception &e)
+    {
+        cb(e.what());
+        return 0;
+    }
+}
+
+void destroySharedPointDataGridReference(SharedPointDataGridReference *reference)
+{
+    delete reference;
+}
+
+// Jobs -------------------------------------------------------------------------------------
+
+class ConvertPLYJob : public PointJob
+{
+public:
+    ConvertPLYJob(const string &filename, const string &outfile, const PointConversionOptions &options)
+        : mFilename(filename), mOutfile(outfile), mOptions(options), mReport() {}
+
+    const PointConversionReport &report() const { return mReport; }
+
+protected:
+    void run() override
+    {
+        this->setMessage("Converting " + mFilename + " to VDB format");
+        if (mOptions.memoryBudget > 0)
+        {
+            cloudToVDBStreaming(mFilename, mOutfile, mOptions, &mReport, &interrupter);
+        }
+        else
+        {
+            interrupter.beginStage(0.0f, 0.3f);
+            PLYReader::PointData<float, uint8_t> cloud = PLYReader::readply(mFilename);
+            interrupter.checkpoint();
+            interrupter.beginStage(0.3f, 1.0f);
+            cloudToVDB(cloud, mOutfile, mOptions, &mReport, &interrupter);
+        }
+        this->setMessage("Successfully converted " + mFilename + " to " + mOutfile);
+    }
+
+private:
+    string mFilename, mOutfile;
+    PointConversionOptions mOptions;
+    PointConversionReport mReport;
+};
+
+class ReadPointGridJob : public PointJob
+{
+public:
+    ReadPointGridJob(const string &filename, const string &gridName, const PointGridOpenOptions &options)
+        : mFilename(filename), mGridName(gridName), mOptions(options) {}
+
+    /// Hand the reference to the caller, once.
+    SharedPointDataGridReference *take() { return mReference.release(); }
+
+protected:
+    void run() override
+    {
+        this->setMessage("Reading PointDataGrid from " + mFilename);
+        unique_ptr<SharedPointDataGridReference> reference(new SharedPointDataGridReference());
+        readPointGridInto(reference.get(), mFilename, mGridName, mOptions, &interrupter);
+        mReference = move(reference);
+        this->setMessage("Read " + to_string(pointCount(mReference->gridPtr->tree())) + " points from " + mFilename);
+    }
+
+private:
+    string mFilename, mGridName;
+    PointGridOpenOptions mOptions;
+    unique_ptr<SharedPointDataGridReference> mReference;
+};
+
+class MeshPointGridJob : public PointJob
+{
+public:
+    MeshPointGridJob(SharedPointDataGridReference *reference, const PointMeshOptions &options)
+        : mReference(reference), mOptions(options) {}
+
+    SharedPointDataGridReference *reference() const { return mReference; }
+
+protected:
+    void run() override
+    {
+        this->setMessage("Constructing Mesh from Point Grid");
+        // record into the reference, as computeMeshFromPointGrid does
+        PointMetricsScope metricsScope(&mReference->metrics);
+        // build aside so a cancelled run leaves the reference's previous mesh in place
+        MeshData mesh;
+        buildReferenceMesh(mReference, mOptions, mesh, &interrupter);
+        swap(mReference->mesh, mesh);
+        this->setMessage("Total Vertices: " + to_string(mReference->mesh.pointCount) + "\n" +
+                         "Total Faces: " + to_string(mReference->mesh.triangleCount()));
+    }
+
+private:
+    SharedPointDataGridReference *mReference;
+    PointMeshOptions mOptions;
+};
+
+bool setJobConcurrency(int threads)
+{
+    return PointJobManager::instance().setConcurrency(threads);
+}
+
+int startConvertPLYToVDBJob(const char *filename, const char *outfile, int lodLevels, size_t memoryBudget)
+{
+    PointConversionOptions options = defaultPointConversionOptions();
+    options.lodLevels = lodLevels;
+    options.memoryBudget = memoryBudget;
+    return startConvertPLYToVDBJobWithOptions(filename, outfile, &options);
+}
+
+int startConvertPLYToVDBJobWithOptions(const char *filename, const char *outfile, const PointConversionOptions *options)
+{
+    const PointConversionOptions conversionOptions = options ? *options : defaultPointConversionOptions();
+    return PointJobManager::instance().submit(make_shared<ConvertPLYJob>(filename, outfile, conversionOptions));
+}
+
+int startReadPointGridJob(const char *filename, const char *gridName, const PointGridOpenOptions *options)
+{
+    const PointGridOpenOptions openOptions = options ? *options : defaultPointGridOpenOptions();
+    return PointJobManager::instance().submit(make_shared<ReadPointGridJob>(filename, gridName, openOptions));
+}
+
+int startMeshJob(SharedPointDataGridReference *reference)
+{
+    return startMeshJobWithOptions(reference, nullptr);
+}
+
+int startMeshJobWithOptions(SharedPointDataGridReference *reference, const PointMeshOptions *options)
+{
+    const PointMeshOptions meshOptions = options ? *options : defaultPointMeshOptions();
+    return PointJobManager::instance().submit(make_shared<MeshPointGridJob>(reference, meshOptions));
+}
+
+PointJobStatus getJobStatus(int jobId)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    return job ? job->status() : JobInvalid;
+}
+
+float getJobProgress(int jobId)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    return job ? job->interrupter.progress() : 0.0f;
+}
+
+size_t getJobMessage(int jobId, char *buffer, size_t capacity)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    const string message = job ? job->message() : string();
+    if (buffer && capacity > 0)
+    {
+        const size_t length = min(message.size(), capacity - 1);
+        memcpy(buffer, message.data(), length);
+        buffer[length] = '\0';
+    }
+    return message.size();
+}
+
+bool cancelJob(int jobId)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    if (!job)
+        return false;
+    job->cancel();
+    return true;
+}
+
+SharedPointDataGridReference *takeJobPointGrid(int jobId)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    if (!job || job->status() != JobSucceeded)
+        return nullptr;
+    ReadPointGridJob *readJob = dynamic_cast<ReadPointGridJob *>(job.get());
+    return readJob ? readJob->take() : nullptr;
+}
+
+bool getJobConversionReport(int jobId, PointConversionReport *report)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    if (!job || job->status() != JobSucceeded || !dynamic_cast<ConvertPLYJob *>(job.get()))
+        return false;
+    *report = static_cast<ConvertPLYJob *>(job.get())->report();
+    return true;
+}
+
+bool getJobMeshCounts(int jobId, size_t &pointCount, size_t &triCount)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    pointCount = 0;
+    triCount = 0;
+    if (!job || job->status() != JobSucceeded || !dynamic_cast<MeshPointGridJob *>(job.get()))
+        return false;
+    const MeshData &mesh = static_cast<MeshPointGridJob *>(job.get())->reference()->mesh;
+    pointCount = mesh.pointCount;
+    triCount = mesh.triangleCount();
+    return true;
+}
+
+size_t getJobMetrics(int jobId, PointMetricRecord *records, size_t capacity)
+{
+    shared_ptr<PointJob> job = PointJobManager::instance().find(jobId);
+    return job ? job->metrics.read(records, capacity) : 0;
+}
+
+void releaseJob(int jobId)
+{
+    PointJobManager::instance().release(jobId);
+}
+
+// Metrics ----------------------------------------------------------------------------------
+
+void setMetricsEnabled(bool enabled)
+{
+    pointMetricsEnabled().store(enabled);
+}
+
+size_t getPointGridMetrics(SharedPointDataGridReference *reference, PointMetricRecord *records, size_t capacity)
+{
+    return reference->metrics.read(records, capacity);
+}
+
+void resetPointGridMetrics(SharedPointDataGridReference *reference)
+{
+    reference->metrics.reset();
+}
+
+size_t getProcessMetrics(PointMetricRecord *records, size_t capacity)
+{
+    return processPointMetrics().read(records, capacity);
+}
+
+void resetProcessMetrics()
+{
+    processPointMetrics().reset();
 }
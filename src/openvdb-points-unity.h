@@ -9,8 +9,24 @@
 #include <openvdb/points/PointCount.h>
 #include <openvdb/tools/ParticlesToLevelSet.h>
 #include <openvdb/tools/GridTransformer.h>
+#include <tbb/task_arena.h>
+#include <tbb/enumerable_thread_specific.h>
 #include "particle-list-wrapper.h"
+#include "mesh-data.h"
+#include "point-gather.h"
+#include "point-encoding.h"
+#include "point-culling.h"
+#include "point-query.h"
+#include "point-lod.h"
+#include "point-grid-cache.h"
+#include "point-jobs.h"
+#include "point-conversion-options.h"
+#include "point-metrics.h"
+#include "region-mesh.h"
+#include "level-set-cache.h"
+#include "point-cache.h"
 #include "readply.h"
+#include "point-attribute-wrapper.h"
 using namespace std;
 
 typedef void (*LoggingCallback)(const char *message);
@@ -19,12 +35,53 @@ class SharedPointDataGridReference
 {
 public:
     openvdb::points::PointDataGrid::Ptr gridPtr;
-    vector<openvdb::Vec3s> meshPoints;
-    vector<openvdb::Vec3I> meshTriangles;
-    SharedPointDataGridReference(openvdb::points::PointDataGrid::Ptr ptr) { gridPtr = ptr; }
-    SharedPointDataGridReference(){};
+    MeshData mesh;
+    vector<openvdb::Index64> leafOffsets;
+    LeafBoundsTable leafBounds;
+    PointQueryIndex queryIndex;
+    PointLODPyramid lod;
+    /// Everything recorded by calls on this reference, see getPointGridMetrics.
+    PointMetrics metrics;
+    /// Meshes per region and the leaves appended to since they were built, see remeshPointGridRegions.
+    RegionMeshSet regionMeshes;
+    /// Level sets meshed from, so changing only the iso value or adaptivity skips rasterizing.
+    LevelSetCache levelSets;
+    /// Identity of the points for level sets read or written, see pointIdentity.
+    PointGridIdentity identity;
+    SharedPointDataGridReference(openvdb::points::PointDataGrid::Ptr ptr) : identity() { gridPtr = ptr; }
+    SharedPointDataGridReference() : identity(){};
+    /// Per leaf point offsets from computeLeafPointOffsets, built on first use.
+    const vector<openvdb::Index64> &leafPointOffsets()
+    {
+        if (leafOffsets.empty())
+            leafOffsets = computeLeafPointOffsets(gridPtr->tree());
+        return leafOffsets;
+    }
+    /// Per leaf index space bounds for culling, built on first use.
+    const LeafBoundsTable &leafBoundsTable()
+    {
+        if (leafBounds.size() == 0)
+            leafBounds.build(gridPtr->tree());
+        return leafBounds;
+    }
+    /// Count and checksum of the points from pointGridIdentity, computed on first use.
+    const PointGridIdentity &pointIdentity()
+    {
+        if (identity.count == 0)
+            identity = pointGridIdentity(gridPtr->tree());
+        return identity;
+    }
+    /// First global point index of every leaf for point queries, built on first use.
+    const PointQueryIndex &pointQueryIndex()
+    {
+        if (queryIndex.size() == 0)
+            queryIndex.build(this->leafBoundsTable(), this->leafPointOffsets());
+        return queryIndex;
+    }
 };
 
+/// Mesh resolution relative to the point grid: High rasterizes at half the point voxel size, Medium
+/// at the point voxel size and Low at twice it.
 enum SampleQuality
 {
     High = 1,
@@ -32,19 +89,218 @@ enum SampleQuality
     Low = 3
 };
 
+struct PointMeshOptions
+{
+    SampleQuality quality;
+    float adaptivity; // VolumeToMesh adaptivity: 0 keeps every polygon, up to 1 merges flat areas
+    float isoValue;   // world space offset of the surface, 0 is the surface of the point spheres
+};
+
+inline PointMeshOptions defaultPointMeshOptions()
+{
+    PointMeshOptions options;
+    options.quality = High;
+    options.adaptivity = 0.0f;
+    options.isoValue = 0.0f;
+    return options;
+}
+
 extern "C"
 {
     void openvdbInitialize();
     void openvdbUninitialize();
     bool convertPLYToVDB(const char *filename, const char *outfile, LoggingCallback cb);
+    /// Also write lodLevels coarser point grids named Points_LOD1, Points_LOD2, ... next to "Points"
+    bool convertPLYToVDBWithLOD(const char *filename, const char *outfile, int lodLevels, LoggingCallback cb);
+    /// Convert in batches, keeping the conversion working set near memoryBudget bytes. Fails for ascii files
+    /// and files with list properties in their vertices, which can't be read in batches
+    bool convertPLYToVDBStreaming(const char *filename, const char *outfile, size_t memoryBudget, LoggingCallback cb);
+    /// Options may be null for the defaults (uncompressed positions, as convertPLYToVDB). report, if not
+    /// null, receives the bytes written and the encode and write times
+    bool convertPLYToVDBWithOptions(const char *filename, const char *outfile, const PointConversionOptions *options,
+                                    PointConversionReport *report, LoggingCallback cb);
+    // Baked point caches hold the points of a grid ready for upload: 16 bit positions relative to each leaf,
+    // RGBA8 colors and a leaf table, in page aligned sections of one file (see point-cache.h). They are mapped
+    // rather than read, so opening one decodes nothing.
+    /// Bake the named point grid of a VDB file, such as one convertPLYToVDB wrote
+    bool bakePointCacheFromFile(const char *filename, const char *gridName, const char *cachefile, LoggingCallback cb);
+    bool bakePointCache(SharedPointDataGridReference *reference, const char *cachefile, LoggingCallback cb);
+    /// Null if the file isn't a cache of this version
+    PointCacheFile *openPointCache(const char *cachefile, LoggingCallback cb);
+    void getPointCacheInfo(PointCacheFile *cache, PointCacheInfo *info);
+    /// Start of a section in the mapping, page aligned and valid until closePointCache; null if the section is
+    /// empty. bytes, if not null, receives its size
+    const void *getPointCacheSection(PointCacheFile *cache, PointCacheSection section, size_t *bytes);
+    void closePointCache(PointCacheFile *cache);
+    /// Same as readPointGridFromFileWithOptions with delayed loading and the shared cache
     SharedPointDataGridReference *readPointGridFromFile(const char *filename, const char *gridName, LoggingCallback cb);
+    /// Options may be null for the defaults. Grids opened with the cache are shared between references
+    /// and stay open (for delayed loading) until the last one is destroyed
+    SharedPointDataGridReference *readPointGridFromFileWithOptions(const char *filename, const char *gridName,
+                                                                   const PointGridOpenOptions *options, LoggingCallback cb);
+    /// Number of files currently held open by the grid cache
+    size_t getPointGridCacheSize();
     openvdb::Index64 getPointCountFromGrid(SharedPointDataGridReference *reference);
     void computeMeshFromPointGrid(SharedPointDataGridReference *reference, size_t &pointCount, size_t &triCount, LoggingCallback cb);
+    /// Options may be null for the defaults computeMeshFromPointGrid uses
+    void computeMeshFromPointGridWithOptions(SharedPointDataGridReference *reference, const PointMeshOptions *options,
+                                             size_t &pointCount, size_t &triCount, LoggingCallback cb);
+    // The buffers below are sized from the counts computeMeshFromPointGrid reports: capacity is in
+    // vertices (three floats each) or triangles (three indices each). They return false if it is too small.
+    bool getMeshVertices(SharedPointDataGridReference *reference, float *vertices, size_t capacity);
+    bool getMeshNormals(SharedPointDataGridReference *reference, float *normals, size_t capacity);
+    bool getMeshTriangles(SharedPointDataGridReference *reference, uint32_t *indices, size_t capacity);
+    // Point export: capacity is in points and the return value is the number of points written, or 0
+    // if the buffer is too small. Positions are in world space; colors are decoded from "Cd".
+    size_t getPointPositions(SharedPointDataGridReference *reference, float *positions, size_t capacity);
+    size_t getPointColors(SharedPointDataGridReference *reference, float *colors, size_t capacity);
+    /// UNorm formats quantize positions against the grid bounds, returned through boundsMin and boundsMax
+    size_t getPointPositionsEncoded(SharedPointDataGridReference *reference, void *positions, size_t capacity,
+                                    PointBufferLayout layout, PointBufferFormat format, float *boundsMin, float *boundsMax);
+    size_t getPointColorsEncoded(SharedPointDataGridReference *reference, void *colors, size_t capacity,
+                                 PointBufferLayout layout, PointBufferFormat format);
+    // Culling: planes are six (nx, ny, nz, d) world planes with n.p + d >= 0 inside, as returned by
+    // GeometryUtility.CalculateFrustumPlanes. Leaf ids index LeafManager order, matching the point
+    // export offsets. Each returns the full visible count and writes at most capacity entries.
+    size_t cullLeavesFrustum(SharedPointDataGridReference *reference, const float *planes, uint32_t *leafIds, size_t capacity);
+    size_t cullLeavesBox(SharedPointDataGridReference *reference, const float *boxMin, const float *boxMax, uint32_t *leafIds, size_t capacity);
+    size_t cullPointsFrustum(SharedPointDataGridReference *reference, const float *planes, float *positions, size_t capacity);
+    size_t cullPointsBox(SharedPointDataGridReference *reference, const float *boxMin, const float *boxMax, float *positions, size_t capacity);
+    /// Per camera state for frame to frame reuse; must be destroyed before its reference
+    FrustumCullHandle *createFrustumCullState(SharedPointDataGridReference *reference);
+    size_t cullLeavesFrustumIncremental(FrustumCullHandle *handle, const float *planes, uint32_t *leafIds, size_t capacity);
+    size_t cullPointsFrustumIncremental(SharedPointDataGridReference *reference, FrustumCullHandle *handle, const float *planes, float *positions, size_t capacity);
+    void destroyFrustumCullState(FrustumCullHandle *handle);
+    // Level of detail: levels are built in memory here, or loaded with the grid when the file has them.
+    int buildPointLOD(SharedPointDataGridReference *reference, int levelCount, LoggingCallback cb);
+    /// World space size of pixelError pixels at distance for a perspective camera
+    float computeLODWorldError(float pixelError, float distance, float verticalFovRadians, float screenHeightPixels);
+    /// Points (and colors if not null) of the level chosen for the budget and error, see PointLODPyramid::selectLevel.
+    /// Returns the level's point count and reports the level (-1 is full resolution). Levels are chosen to fit in
+    /// capacity; when even the coarsest doesn't, nothing is written and 0 is returned, with the level still reported.
+    size_t queryPointLOD(SharedPointDataGridReference *reference, size_t pointBudget, float maxWorldError,
+                         float *positions, float *colors, size_t capacity, int *level);
+    // Point queries walk the tree from the query and test only points within reach, for picking, measuring and
+    // snapping. Hits carry the point's index in the point export order. They need a linear transform with uniform
+    // voxels and return nothing otherwise.
+    /// The point nearest the origin along a world ray among those within radius of it, no further than maxDistance
+    /// along it (0 for no limit); hit->distance is along the ray. direction need not be normalized
+    bool pickPointAlongRay(SharedPointDataGridReference *reference, const float *origin, const float *direction, float radius,
+                           float maxDistance, PointQueryHit *hit);
+    /// The k points nearest position within maxDistance (0 for no limit), nearest first; hits holds k entries.
+    /// Returns the number found
+    size_t queryNearestPoints(SharedPointDataGridReference *reference, const float *position, size_t k, float maxDistance,
+                              PointQueryHit *hits);
+    /// Points within radius of position, nearest first. Returns the full count and writes at most capacity hits
+    size_t queryPointsInRadius(SharedPointDataGridReference *reference, const float *position, float radius,
+                               PointQueryHit *hits, size_t capacity);
+    // Incremental updates: points are appended to the grid in place and meshes are kept per region of
+    // 32 point voxels, so remeshing after an append only rebuilds the regions the new points reach.
+    // Neither may run while a job uses the reference.
+    /// Insert count points, xyz world positions and rgb colors (null for black), with the grid's transform and
+    /// codecs. The grid is dropped from the shared grid cache, so later reads load the file again. A grid
+    /// shared with other references is deep copied first, which costs the whole grid once; later appends
+    /// to the copy cost only their batch. Per leaf tables for culling, queries and export are rebuilt on
+    /// their next use. LOD levels are dropped and the whole grid mesh of computeMeshFromPointGrid is left
+    /// as it was
+    bool appendPointsToGrid(SharedPointDataGridReference *reference, const float *positions, const uint8_t *colors,
+                            size_t count, LoggingCallback cb);
+    /// Mesh the regions within reach of the points appended since the last call; the first call, and any call
+    /// with a different quality or iso value, meshes every region. Options may be null for the defaults; their
+    /// adaptivity is ignored and regions are meshed at 0, since adaptive polygons would leave cracks where a
+    /// remeshed region meets its neighbours. Returns the number of regions changed, the delta
+    size_t remeshPointGridRegions(SharedPointDataGridReference *reference, const PointMeshOptions *options, LoggingCallback cb);
+    /// Keys of the last delta, three ints per region; writes at most capacity keys and returns the delta size.
+    /// Regions in the delta without triangles have been removed
+    size_t getRegionMeshDelta(SharedPointDataGridReference *reference, int32_t *keys, size_t capacity);
+    /// Counts of a region's mesh, false (and zero counts) if the region has no triangles
+    bool getRegionMeshCounts(SharedPointDataGridReference *reference, const int32_t *key, size_t &pointCount, size_t &triCount);
+    // Region buffers are sized as the whole mesh buffers above, from getRegionMeshCounts
+    bool getRegionMeshVertices(SharedPointDataGridReference *reference, const int32_t *key, float *vertices, size_t capacity);
+    bool getRegionMeshNormals(SharedPointDataGridReference *reference, const int32_t *key, float *normals, size_t capacity);
+    bool getRegionMeshTriangles(SharedPointDataGridReference *reference, const int32_t *key, uint32_t *indices, size_t capacity);
+    // Level sets: meshing rasterizes once per quality and keeps the level set on the reference, or finds
+    // it in the file the points were read from (see PointConversionOptions::levelSetQuality). Appending
+    // points drops them.
+    /// Rasterize ahead of meshing, e.g. to write a sidecar
+    bool cachePointGridLevelSet(SharedPointDataGridReference *reference, SampleQuality quality, LoggingCallback cb);
+    /// Write the cached level sets to a sidecar file, e.g. next to the points file
+    bool writePointGridLevelSets(SharedPointDataGridReference *reference, const char *filename, LoggingCallback cb);
+    /// Cache the level sets in filename that were rasterized from the same points; returns how many
+    int readPointGridLevelSets(SharedPointDataGridReference *reference, const char *filename, LoggingCallback cb);
     void destroySharedPointDataGridReference(SharedPointDataGridReference *reference);
+    // Jobs run the calls above on a dedicated task arena and return an id to poll from the caller's
+    // thread. Ids stay valid until releaseJob; a reference being meshed must outlive its job.
+    /// Threads of the job arena, 0 for all cores but one. Fails while jobs are running
+    bool setJobConcurrency(int threads);
+    /// memoryBudget 0 reads the whole cloud at once, otherwise converts in batches as convertPLYToVDBStreaming
+    int startConvertPLYToVDBJob(const char *filename, const char *outfile, int lodLevels, size_t memoryBudget);
+    int startConvertPLYToVDBJobWithOptions(const char *filename, const char *outfile, const PointConversionOptions *options);
+    int startReadPointGridJob(const char *filename, const char *gridName, const PointGridOpenOptions *options);
+    int startMeshJob(SharedPointDataGridReference *reference);
+    int startMeshJobWithOptions(SharedPointDataGridReference *reference, const PointMeshOptions *options);
+    PointJobStatus getJobStatus(int jobId);
+    float getJobProgress(int jobId);
+    /// Copies the job's latest message, or its error, into buffer and returns the full message length
+    size_t getJobMessage(int jobId, char *buffer, size_t capacity);
+    /// Metrics recorded by a conversion or read job; mesh jobs record into their reference
+    size_t getJobMetrics(int jobId, PointMetricRecord *records, size_t capacity);
+    bool cancelJob(int jobId);
+    /// Reference read by a succeeded read job, handed over once; the caller destroys it
+    SharedPointDataGridReference *takeJobPointGrid(int jobId);
+    /// Report of a succeeded conversion job; false for other jobs and for conversions that failed
+    bool getJobConversionReport(int jobId, PointConversionReport *report);
+    /// Counts of a succeeded mesh job, whose mesh is then on its reference for getMeshVertices and friends
+    bool getJobMeshCounts(int jobId, size_t &pointCount, size_t &triCount);
+    /// Forget a job, cancelling it if it is still running
+    void releaseJob(int jobId);
+    // Metrics: timers (nanoseconds), counters and peaks for every stage, see PointMetricId. Each getter
+    // fills up to capacity records and returns the number of metrics, MetricCount.
+    /// On by default; when off, recording is a single relaxed load
+    void setMetricsEnabled(bool enabled);
+    size_t getPointGridMetrics(SharedPointDataGridReference *reference, PointMetricRecord *records, size_t capacity);
+    void resetPointGridMetrics(SharedPointDataGridReference *reference);
+    /// Totals over every call in the process, including conversions, which have no reference
+    size_t getProcessMetrics(PointMetricRecord *records, size_t capacity);
+    void resetProcessMetrics();
 }
 
-void cloudToVDB(PLYReader::PointData<float, uint8_t> cloud, string filename);
+void cloudToVDB(const PLYReader::PointData<float, uint8_t> &cloud, string filename,
+                const PointConversionOptions &options = defaultPointConversionOptions(),
+                PointConversionReport *report = nullptr, JobInterrupter *interrupter = nullptr);
+/// Progress goes to the interrupter's stage; cb, if not null, receives a message per batch. Throws if
+/// options ask for a level set, which can't be rasterized within the memory budget, or if a budget is
+/// set and the file is ascii or has list properties in its vertices, which can't be read in batches
+void cloudToVDBStreaming(string plyPath, string filename, const PointConversionOptions &options,
+                         PointConversionReport *report = nullptr, JobInterrupter *interrupter = nullptr,
+                         LoggingCallback cb = nullptr);
+void writePointGrids(const string &filename, const openvdb::GridPtrVec &grids, FileCompression compression, PointConversionReport *report);
+double meshVoxelSize(double pointVoxelSize, SampleQuality quality);
+double meshParticleRadius(double pointVoxelSize, double rasterVoxelSize);
+openvdb::FloatGrid::Ptr rasterizePointGrid(const PointDataParticleList &particles, double rasterVoxelSize, JobInterrupter *interrupter);
+void meshLevelSet(const openvdb::FloatGrid &levelSet, const PointMeshOptions &options, MeshData &mesh);
+void buildPointGridMesh(const openvdb::points::PointDataGrid &grid, const PointMeshOptions &options, MeshData &mesh, JobInterrupter *interrupter);
+string levelSetGridName(const string &pointGridName, SampleQuality quality);
+openvdb::FloatGrid::Ptr rasterizePointGridLevelSet(const openvdb::points::PointDataGrid &grid, SampleQuality quality, JobInterrupter *interrupter);
+openvdb::FloatGrid::Ptr readMatchingLevelSet(const string &filename, const string &name, double voxelSize, double radius,
+                                             const PointGridIdentity &points);
+openvdb::FloatGrid::Ptr pointGridLevelSet(SharedPointDataGridReference *reference, SampleQuality quality, JobInterrupter *interrupter);
+void buildReferenceMesh(SharedPointDataGridReference *reference, const PointMeshOptions &options, MeshData &mesh, JobInterrupter *interrupter);
+PointConversionOptions pointGridConversionOptions(const openvdb::points::PointDataGrid &grid);
+vector<openvdb::Coord> appendCloudToPointGrid(openvdb::points::PointDataGrid &grid, PLYReader::PointData<float, uint8_t> &batch);
+size_t remeshRegions(const openvdb::points::PointDataGrid &grid, const PointMeshOptions &options, RegionMeshSet &regions,
+                     const openvdb::FloatGrid *levelSet, JobInterrupter *interrupter);
+void appendPointLODGrids(openvdb::GridPtrVec &grids, const openvdb::points::PointDataGrid &grid, int lodLevels);
+void appendPointLevelSetGrid(openvdb::GridPtrVec &grids, const openvdb::points::PointDataGrid &grid, int levelSetQuality);
+void loadPointLOD(string filename, string gridName, PointLODPyramid &lod);
+void cloudAttributeColumns(const PLYReader::PointData<float, uint8_t> &cloud, const PointConversionOptions &options,
+                           vector<unique_ptr<PointAttributeColumn>> &columns);
+openvdb::points::PointDataGrid::Ptr createPointDataGridFromCloud(const PLYReader::PointData<float, uint8_t> &cloud, const openvdb::math::Transform &transform,
+                                                                 const PointConversionOptions &options = defaultPointConversionOptions());
+void mergePointDataGrids(openvdb::points::PointDataGrid &target, openvdb::points::PointDataGrid &source);
 openvdb::points::PointDataGrid::Ptr loadPointGrid(string filename, string gridName);
+openvdb::points::PointDataGrid::Ptr loadPointGrid(string filename, string gridName, const PointGridOpenOptions &options);
+size_t rasterGrainSize(size_t particleCount);
 
 template<typename GridType>
 typename GridType::Ptr downsampleGrid(typename GridType::Ptr inGrid, SampleQuality quality);
\ No newline at end of file
@@ -1,87 +1,72 @@
+#pragma once
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <exception>
 #include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include "point-gather.h"
 
 using namespace std;
-class MyParticleList
+
+/// Particle list over the points of a PointDataGrid for tools::ParticlesToLevelSet. World
+/// positions are gathered once, in parallel per leaf, into float SoA buffers (12 bytes per
+/// point); every particle shares one radius and has no velocity.
+class PointDataParticleList
 {
 protected:
-  struct MyParticle
-  {
-    openvdb::Vec3R p, v;
-    openvdb::Real r;
-  };
-  openvdb::Real mRadiusScale;
-  openvdb::Real mVelocityScale;
-  std::vector<MyParticle> mParticleList;
+  vector<float> mX, mY, mZ;
+  openvdb::Real mRadius;
 
 public:
   typedef openvdb::Vec3R PosType;
 
-  MyParticleList(openvdb::Real rScale = 1, openvdb::Real vScale = 1)
-      : mRadiusScale(rScale), mVelocityScale(vScale) {}
-  void add(const openvdb::Vec3R &p, const openvdb::Real &r,
-           const openvdb::Vec3R &v = openvdb::Vec3R(0, 0, 0))
+  PointDataParticleList(const openvdb::points::PointDataGrid &grid, openvdb::Real radius)
+      : mRadius(radius)
   {
-    MyParticle pa;
-    pa.p = p;
-    pa.r = r;
-    pa.v = v;
-    mParticleList.push_back(pa);
+    const vector<openvdb::Index64> offsets = computeLeafPointOffsets(grid.tree());
+    const size_t count = offsets.back();
+    mX.resize(count);
+    mY.resize(count);
+    mZ.resize(count);
+    if (count > 0)
+      gatherWorldPositions(grid, offsets, mX.data(), mY.data(), mZ.data());
   }
-  /// @return coordinate bbox in the space of the specified transfrom
-  openvdb::CoordBBox getBBox(const openvdb::GridBase &grid)
+
+  /// Particles of some leaves of grid only, for meshing part of it.
+  PointDataParticleList(const openvdb::points::PointDataGrid &grid,
+                        const vector<const openvdb::points::PointDataTree::LeafNodeType *> &leaves, openvdb::Real radius)
+      : mRadius(radius)
   {
-    openvdb::CoordBBox bbox;
-    openvdb::Coord &min = bbox.min(), &max = bbox.max();
-    openvdb::Vec3R pos;
-    openvdb::Real rad, invDx = 1 / grid.voxelSize()[0];
-    for (size_t n = 0, e = this->size(); n < e; ++n)
-    {
-      this->getPosRad(n, pos, rad);
-      const openvdb::Vec3d xyz = grid.worldToIndex(pos);
-      const openvdb::Real r = rad * invDx;
-      for (int i = 0; i < 3; ++i)
+    vector<openvdb::Index64> offsets(leaves.size() + 1, 0);
+    for (size_t i = 0; i < leaves.size(); ++i)
+      offsets[i + 1] = offsets[i] + leaves[i]->onPointCount();
+    mX.resize(offsets.back());
+    mY.resize(offsets.back());
+    mZ.resize(offsets.back());
+    const AffineIndexToWorld indexToWorld(grid.transform());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, leaves.size()), [&](const tbb::blocked_range<size_t> &range) {
+      for (size_t i = range.begin(); i < range.end(); ++i)
       {
-        min[i] = openvdb::math::Min(min[i], openvdb::math::Floor(xyz[i] - r));
-        max[i] = openvdb::math::Max(max[i], openvdb::math::Ceil(xyz[i] + r));
+        const size_t begin = offsets[i], count = offsets[i + 1] - begin;
+        float *x = mX.data() + begin, *y = mY.data() + begin, *z = mZ.data() + begin;
+        decodeLeafIndexPositions(*leaves[i], x, y, z);
+        indexToWorld.apply(x, y, z, count);
       }
-    }
-    return bbox;
+    });
   }
-  //typedef int AttributeType;
-  // The methods below are only required for the unit-tests
-  openvdb::Vec3R pos(int n) const { return mParticleList[n].p; }
-  openvdb::Vec3R vel(int n) const { return mVelocityScale * mParticleList[n].v; }
-  openvdb::Real radius(int n) const { return mRadiusScale * mParticleList[n].r; }
-
-  //////////////////////////////////////////////////////////////////////////////
-  /// The methods below are the only ones required by tools::ParticleToLevelSet
-  /// @note We return by value since the radius and velocities are modified
-  /// by the scaling factors! Also these methods are all assumed to
-  /// be thread-safe.
-
-  /// Return the total number of particles in list.
-  ///  Always required!
-  size_t size() const { return mParticleList.size(); }
-
-  /// Get the world space position of n'th particle.
-  /// Required by ParticledToLevelSet::rasterizeSphere(*this,radius).
-  void getPos(size_t n, openvdb::Vec3R &pos) const { pos = mParticleList[n].p; }
 
+  size_t size() const { return mX.size(); }
+  void getPos(size_t n, openvdb::Vec3R &pos) const { pos = openvdb::Vec3R(mX[n], mY[n], mZ[n]); }
   void getPosRad(size_t n, openvdb::Vec3R &pos, openvdb::Real &rad) const
   {
-    pos = mParticleList[n].p;
-    rad = mRadiusScale * mParticleList[n].r;
+    this->getPos(n, pos);
+    rad = mRadius;
   }
   void getPosRadVel(size_t n, openvdb::Vec3R &pos, openvdb::Real &rad, openvdb::Vec3R &vel) const
   {
-    pos = mParticleList[n].p;
-    rad = mRadiusScale * mParticleList[n].r;
-    vel = mVelocityScale * mParticleList[n].v;
+    this->getPosRad(n, pos, rad);
+    vel = openvdb::Vec3R(0, 0, 0);
   }
-  // The method below is only required for attribute transfer
   void getAtt(size_t n, openvdb::Index32 &att) const { att = openvdb::Index32(n); }
-};
\ No newline at end of file
+};
@@ -0,0 +1,185 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include <openvdb/points/PointAttribute.h>
+#include <openvdb/tools/PointIndexGrid.h>
+#include <openvdb/tree/LeafManager.h>
+#include "readply.h"
+
+using namespace std;
+
+/// Position wrapper over the reader's float buffer, satisfying the PointArray interface used by
+/// createPointIndexGrid, createPointDataGrid and computeVoxelSize without a Vec3R copy.
+class PLYPositionWrapper
+{
+public:
+  typedef openvdb::Vec3R PosType;
+  typedef openvdb::Vec3R value_type;
+
+  explicit PLYPositionWrapper(const vector<PLYReader::point<float>> &vertices) : mVertices(vertices) {}
+
+  size_t size() const { return mVertices.size(); }
+  void getPos(size_t n, openvdb::Vec3R &xyz) const
+  {
+    const PLYReader::point<float> &p = mVertices[n];
+    xyz = openvdb::Vec3R(p.x, p.y, p.z);
+  }
+
+private:
+  const vector<PLYReader::point<float>> &mVertices;
+};
+
+/// Color wrapper over the reader's 8 bit buffer for populateAttribute, converting to [0, 1]
+/// on the fly instead of building a Vec3f copy.
+class PLYColorWrapper
+{
+public:
+  typedef openvdb::Vec3f value_type;
+
+  explicit PLYColorWrapper(const vector<PLYReader::rgb<uint8_t>> &colors) : mColors(colors) {}
+
+  size_t size() const { return mColors.size(); }
+  template <typename T>
+  void get(T &value, size_t n) const
+  {
+    const PLYReader::rgb<uint8_t> &c = mColors[n];
+    value = T(c.r / 255.0f, c.g / 255.0f, c.b / 255.0f);
+  }
+  template <typename T>
+  void get(T &value, size_t n, openvdb::Index /*m*/) const { this->get(value, n); }
+
+private:
+  const vector<PLYReader::rgb<uint8_t>> &mColors;
+};
+
+/// 16 bit color wrapper for sources with wider channels, see PLYReader::PointData::wideColor.
+class PLYWideColorWrapper
+{
+public:
+  typedef openvdb::Vec3f value_type;
+
+  explicit PLYWideColorWrapper(const vector<PLYReader::rgb<uint16_t>> &colors) : mColors(colors) {}
+
+  size_t size() const { return mColors.size(); }
+  template <typename T>
+  void get(T &value, size_t n) const
+  {
+    const PLYReader::rgb<uint16_t> &c = mColors[n];
+    value = T(c.r / 65535.0f, c.g / 65535.0f, c.b / 65535.0f);
+  }
+
+private:
+  const vector<PLYReader::rgb<uint16_t>> &mColors;
+};
+
+/// Normal wrapper, normalizing on the way out since UnitVecCodec stores directions only.
+class PLYNormalWrapper
+{
+public:
+  typedef openvdb::Vec3f value_type;
+
+  explicit PLYNormalWrapper(const vector<PLYReader::point<float>> &normals) : mNormals(normals) {}
+
+  size_t size() const { return mNormals.size(); }
+  template <typename T>
+  void get(T &value, size_t n) const
+  {
+    const PLYReader::point<float> &p = mNormals[n];
+    value = T(p.x, p.y, p.z);
+    value.normalize();
+  }
+
+private:
+  const vector<PLYReader::point<float>> &mNormals;
+};
+
+/// Wrapper over a packed scalar column of ValueT.
+template <typename ValueT>
+class PLYScalarWrapper
+{
+public:
+  typedef ValueT value_type;
+
+  explicit PLYScalarWrapper(const PLYReader::ScalarColumn &column)
+      : mValues(reinterpret_cast<const ValueT *>(column.data.data())), mSize(column.data.size() / sizeof(ValueT)) {}
+
+  size_t size() const { return mSize; }
+  void get(ValueT &value, size_t n) const { value = mValues[n]; }
+
+private:
+  const ValueT *mValues;
+  size_t mSize;
+};
+
+/// One attribute to create and fill from a cloud, see populatePointAttributes.
+class PointAttributeColumn
+{
+public:
+  typedef openvdb::tools::PointIndexTree::LeafNodeType::IndexArray IndexArray;
+
+  explicit PointAttributeColumn(const string &name) : mName(name) {}
+  virtual ~PointAttributeColumn() {}
+
+  const string &name() const { return mName; }
+  virtual void append(openvdb::points::PointDataTree &tree) const = 0;
+  /// Write the values of the points of one leaf, listed by the matching point index leaf.
+  virtual void write(openvdb::points::AttributeArray &array, const IndexArray &indices) const = 0;
+
+private:
+  string mName;
+};
+
+/// Attribute of ValueT stored with CodecT, read from a wrapper with get(ValueT &, size_t).
+template <typename ValueT, typename CodecT, typename WrapperT>
+class TypedPointAttributeColumn : public PointAttributeColumn
+{
+public:
+  TypedPointAttributeColumn(const string &name, const WrapperT &wrapper) : PointAttributeColumn(name), mWrapper(wrapper) {}
+
+  void append(openvdb::points::PointDataTree &tree) const override
+  {
+    openvdb::points::appendAttribute<ValueT, CodecT>(tree, this->name());
+  }
+
+  void write(openvdb::points::AttributeArray &array, const IndexArray &indices) const override
+  {
+    openvdb::points::AttributeWriteHandle<ValueT, CodecT> handle(array);
+    ValueT value;
+    for (size_t i = 0, e = indices.size(); i < e; ++i)
+    {
+      mWrapper.get(value, size_t(indices[i]));
+      handle.set(openvdb::Index(i), value);
+    }
+  }
+
+private:
+  WrapperT mWrapper;
+};
+
+/// Append every column to tree, then fill them all in one parallel pass over the leaves, each
+/// point index leaf read once for all of them. Points are stored in point index order within a
+/// leaf, as createPointDataGrid lays them out.
+inline void populatePointAttributes(openvdb::points::PointDataTree &tree, const openvdb::tools::PointIndexTree &indexTree,
+                                    const vector<unique_ptr<PointAttributeColumn>> &columns)
+{
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  if (columns.empty() || tree.leafCount() == 0)
+    return;
+  for (const auto &column : columns)
+    column->append(tree);
+  const openvdb::points::AttributeSet::Descriptor &descriptor = tree.cbeginLeaf()->attributeSet().descriptor();
+  vector<size_t> positions;
+  for (const auto &column : columns)
+    positions.push_back(descriptor.find(column->name()));
+  openvdb::tree::LeafManager<openvdb::points::PointDataTree> leafManager(tree);
+  leafManager.foreach([&](LeafT &leaf, size_t) {
+    const openvdb::tools::PointIndexTree::LeafNodeType *indexLeaf = indexTree.probeConstLeaf(leaf.origin());
+    if (!indexLeaf)
+      return;
+    for (size_t c = 0; c < columns.size(); ++c)
+      columns[c]->write(leaf.attributeArray(positions[c]), indexLeaf->indices());
+  });
+}
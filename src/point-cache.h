@@ -0,0 +1,329 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "mapped-file.h"
+#include "point-gather.h"
+
+using namespace std;
+
+// Baked point cache: the points of a grid laid out for upload straight from a memory mapping.
+//
+//   header           PointCacheHeader, padded to the alignment
+//   leaf table       PointCacheLeaf per leaf, in LeafManager order
+//   positions        4 x uint16 per point: x, y, z relative to the leaf, w zero
+//   colors           4 x uint8 per point: r, g, b, a = 255; empty when the grid has no "Cd"
+//
+// Each section starts on a POINT_CACHE_ALIGNMENT boundary, 64 KiB, which is a page boundary for 4 KiB
+// and 16 KiB pages and the Windows allocation granularity. Points are stored leaf by leaf in the
+// order of the point export, so point indices match getPointPositions and the point queries.
+// A quantized component q decodes to index space as origin - 0.5 + q * POINT_CACHE_QUANTUM, and to
+// world space through the header's indexToWorld. All values are little endian; caches are written and
+// mapped as native structs, so big endian hosts refuse to bake or open them.
+
+static const char POINT_CACHE_MAGIC[8] = {'V', 'D', 'B', 'P', 'C', 'A', 'C', 'H'};
+static const uint32_t POINT_CACHE_VERSION = 2; // 1 aligned sections to 4 KiB
+static const uint64_t POINT_CACHE_ALIGNMENT = 65536;
+/// Index space extent of one quantization step: a leaf and its half voxel margins over 16 bits.
+static const double POINT_CACHE_QUANTUM = double(openvdb::points::PointDataTree::LeafNodeType::DIM) / 65535.0;
+
+enum PointCacheSection
+{
+  PointCacheLeaves = 0,
+  PointCachePositions = 1,
+  PointCacheColors = 2,
+  PointCacheSectionCount
+};
+
+struct PointCacheRange
+{
+  uint64_t offset; // from the start of the file, a multiple of POINT_CACHE_ALIGNMENT
+  uint64_t bytes;
+};
+
+struct PointCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerBytes; // sizeof(PointCacheHeader) of the writer
+  uint64_t pointCount;
+  uint64_t leafCount;
+  double voxelSize;
+  double indexToWorld[16]; // row major, world = (index, 1) * indexToWorld
+  float boundsMin[3];      // world bounds of every point
+  float boundsMax[3];
+  PointCacheRange sections[PointCacheSectionCount];
+};
+
+/// One leaf of the cache: where its points are and what they cover.
+struct PointCacheLeaf
+{
+  int32_t origin[3]; // index space
+  uint32_t pointCount;
+  uint64_t firstPoint;
+  float boundsMin[3]; // world bounds of the leaf's points
+  float boundsMax[3];
+};
+
+/// What a cache holds, as handed out through the C API.
+struct PointCacheInfo
+{
+  uint32_t version;
+  uint64_t pointCount;
+  uint64_t leafCount;
+  float voxelSize;
+  float indexToWorld[16];
+  float boundsMin[3];
+  float boundsMax[3];
+  bool hasColors;
+};
+
+inline bool pointCacheHostIsLittleEndian()
+{
+  const uint16_t probe = 1;
+  uint8_t first;
+  memcpy(&first, &probe, 1);
+  return first == 1;
+}
+
+inline uint64_t alignPointCacheOffset(uint64_t offset)
+{
+  return (offset + POINT_CACHE_ALIGNMENT - 1) / POINT_CACHE_ALIGNMENT * POINT_CACHE_ALIGNMENT;
+}
+
+inline uint16_t quantizePointCacheComponent(float index, int origin)
+{
+  const double q = (double(index) - double(origin) + 0.5) / POINT_CACHE_QUANTUM;
+  return uint16_t(min(max(q + 0.5, 0.0), 65535.0));
+}
+
+inline uint8_t quantizeUnitColor(float value)
+{
+  return uint8_t(min(max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+/// Write the points of grid as a baked cache. Leaves are encoded in parallel in blocks of about
+/// chunkPoints points and written front to back, so memory stays bounded for any grid size. The
+/// grid needs a linear transform. Returns the file size.
+inline uint64_t bakePointCacheFile(const openvdb::points::PointDataGrid &grid, const string &filename,
+                                   size_t chunkPoints = size_t(1) << 20)
+{
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  const openvdb::math::Transform &transform = grid.transform();
+  if (!transform.isLinear())
+    throw runtime_error("Can't bake a point cache of a grid with a non-linear transform");
+  if (!pointCacheHostIsLittleEndian())
+    throw runtime_error("Point caches are little endian and can't be baked on this host");
+
+  openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(grid.tree());
+  const size_t leafCount = leafManager.leafCount();
+  const vector<openvdb::Index64> offsets = computeLeafPointOffsets(grid.tree());
+  const uint64_t pointCount = offsets.back();
+  const LeafT *first = leafCount > 0 ? &leafManager.leaf(0) : nullptr;
+  const size_t colorIndex = first ? first->attributeSet().find("Cd") : openvdb::points::AttributeSet::INVALID_POS;
+  const bool hasColors = colorIndex != openvdb::points::AttributeSet::INVALID_POS;
+
+  PointCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, POINT_CACHE_MAGIC, sizeof(header.magic));
+  header.version = POINT_CACHE_VERSION;
+  header.headerBytes = uint32_t(sizeof(PointCacheHeader));
+  header.pointCount = pointCount;
+  header.leafCount = leafCount;
+  header.voxelSize = transform.voxelSize().x();
+  const openvdb::Mat4d mat = transform.baseMap()->getAffineMap()->getMat4();
+  for (int r = 0; r < 4; ++r)
+    for (int c = 0; c < 4; ++c)
+      header.indexToWorld[r * 4 + c] = mat[r][c];
+  const openvdb::BBoxd bounds = computeWorldPointBounds(grid);
+  for (int c = 0; c < 3; ++c)
+  {
+    header.boundsMin[c] = float(bounds.min()[c]);
+    header.boundsMax[c] = float(bounds.max()[c]);
+  }
+  PointCacheRange *sections = header.sections;
+  sections[PointCacheLeaves].offset = alignPointCacheOffset(sizeof(PointCacheHeader));
+  sections[PointCacheLeaves].bytes = leafCount * sizeof(PointCacheLeaf);
+  sections[PointCachePositions].offset = alignPointCacheOffset(sections[PointCacheLeaves].offset + sections[PointCacheLeaves].bytes);
+  sections[PointCachePositions].bytes = pointCount * 4 * sizeof(uint16_t);
+  sections[PointCacheColors].offset = alignPointCacheOffset(sections[PointCachePositions].offset + sections[PointCachePositions].bytes);
+  sections[PointCacheColors].bytes = hasColors ? pointCount * 4 : 0;
+
+  ofstream out(filename, ios::binary | ios::trunc);
+  if (!out)
+    throw runtime_error("Failed to create " + filename);
+  // header and leaf table are written last, once the leaf bounds are known
+  const vector<char> zeros(POINT_CACHE_ALIGNMENT, 0);
+  auto padTo = [&](uint64_t offset) {
+    for (uint64_t at = uint64_t(out.tellp()); at < offset; at += zeros.size())
+      out.write(zeros.data(), streamsize(min<uint64_t>(zeros.size(), offset - at)));
+  };
+  padTo(sections[PointCachePositions].offset);
+
+  // blocks of whole leaves holding about chunkPoints points each
+  vector<size_t> blocks(1, 0);
+  for (size_t idx = 0; idx < leafCount; ++idx)
+  {
+    if (offsets[idx + 1] - offsets[blocks.back()] >= chunkPoints)
+      blocks.push_back(idx + 1);
+  }
+  if (blocks.back() != leafCount)
+    blocks.push_back(leafCount);
+
+  vector<PointCacheLeaf> leaves(leafCount);
+  tbb::enumerable_thread_specific<vector<float>> scratch;
+  vector<uint8_t> buffer;
+  for (int pass = 0; pass < (hasColors ? 2 : 1); ++pass)
+  {
+    const bool colors = pass == 1;
+    const size_t stride = colors ? 4 : 4 * sizeof(uint16_t);
+    if (colors)
+      padTo(sections[PointCacheColors].offset);
+    for (size_t b = 0; b + 1 < blocks.size(); ++b)
+    {
+      const size_t blockBegin = offsets[blocks[b]];
+      buffer.resize(size_t(offsets[blocks[b + 1]] - blockBegin) * stride);
+      tbb::parallel_for(tbb::blocked_range<size_t>(blocks[b], blocks[b + 1]), [&](const tbb::blocked_range<size_t> &range) {
+        vector<float> &values = scratch.local();
+        for (size_t idx = range.begin(); idx < range.end(); ++idx)
+        {
+          const LeafT &leaf = leafManager.leaf(idx);
+          const size_t count = size_t(offsets[idx + 1] - offsets[idx]);
+          values.resize(count * 3);
+          float *x = values.data(), *y = x + count, *z = y + count;
+          uint8_t *dst = buffer.data() + size_t(offsets[idx] - blockBegin) * stride;
+          if (colors)
+          {
+            decodeLeafVec3Attribute(leaf, colorIndex, x, y, z);
+            for (size_t n = 0; n < count; ++n, dst += 4)
+            {
+              dst[0] = quantizeUnitColor(x[n]);
+              dst[1] = quantizeUnitColor(y[n]);
+              dst[2] = quantizeUnitColor(z[n]);
+              dst[3] = 255;
+            }
+            continue;
+          }
+          const openvdb::Coord &origin = leaf.origin();
+          decodeLeafIndexPositions(leaf, x, y, z);
+          uint16_t *q = reinterpret_cast<uint16_t *>(dst);
+          for (size_t n = 0; n < count; ++n, q += 4)
+          {
+            q[0] = quantizePointCacheComponent(x[n], origin.x());
+            q[1] = quantizePointCacheComponent(y[n], origin.y());
+            q[2] = quantizePointCacheComponent(z[n], origin.z());
+            q[3] = 0;
+          }
+          PointCacheLeaf &entry = leaves[idx];
+          for (int c = 0; c < 3; ++c)
+            entry.origin[c] = origin[c];
+          entry.pointCount = uint32_t(count);
+          entry.firstPoint = offsets[idx];
+          openvdb::BBoxd box;
+          if (count > 0)
+          {
+            const float *axes[3] = {x, y, z};
+            for (int c = 0; c < 3; ++c)
+            {
+              box.min()[c] = *min_element(axes[c], axes[c] + count);
+              box.max()[c] = *max_element(axes[c], axes[c] + count);
+            }
+          }
+          else
+            box = openvdb::BBoxd(origin.asVec3d(), origin.asVec3d());
+          box = transform.indexToWorld(box);
+          for (int c = 0; c < 3; ++c)
+          {
+            entry.boundsMin[c] = float(box.min()[c]);
+            entry.boundsMax[c] = float(box.max()[c]);
+          }
+        }
+      });
+      out.write(reinterpret_cast<const char *>(buffer.data()), streamsize(buffer.size()));
+    }
+  }
+  const uint64_t fileBytes = uint64_t(out.tellp());
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.seekp(streamoff(sections[PointCacheLeaves].offset));
+  if (!leaves.empty())
+    out.write(reinterpret_cast<const char *>(leaves.data()), streamsize(leaves.size() * sizeof(PointCacheLeaf)));
+  out.close();
+  if (!out)
+    throw runtime_error("Failed to write " + filename);
+  return fileBytes;
+}
+
+/// A baked cache mapped read only. Opening checks the header and section ranges and touches
+/// nothing else, so points are only paged in as they are read or uploaded.
+class PointCacheFile
+{
+public:
+  explicit PointCacheFile(const string &filename) : mFile(filename)
+  {
+    if (!pointCacheHostIsLittleEndian())
+      throw runtime_error("Point caches are little endian and can't be opened on this host");
+    if (mFile.size() < sizeof(PointCacheHeader))
+      throw runtime_error(filename + " is not a point cache");
+    mHeader = reinterpret_cast<const PointCacheHeader *>(mFile.data());
+    if (memcmp(mHeader->magic, POINT_CACHE_MAGIC, sizeof(POINT_CACHE_MAGIC)) != 0)
+      throw runtime_error(filename + " is not a point cache");
+    if (mHeader->version != POINT_CACHE_VERSION || mHeader->headerBytes != sizeof(PointCacheHeader))
+      throw runtime_error(filename + " is a point cache of version " + to_string(mHeader->version) + ", expected " +
+                          to_string(POINT_CACHE_VERSION));
+    const uint64_t expected[PointCacheSectionCount] = {mHeader->leafCount * sizeof(PointCacheLeaf),
+                                                       mHeader->pointCount * 4 * sizeof(uint16_t), mHeader->pointCount * 4};
+    for (int s = 0; s < PointCacheSectionCount; ++s)
+    {
+      const PointCacheRange &range = mHeader->sections[s];
+      if (s == PointCacheColors && range.bytes == 0)
+        continue;
+      // empty sections may sit past the end of the file
+      if (range.bytes != expected[s] || range.offset % POINT_CACHE_ALIGNMENT != 0 ||
+          (range.bytes > 0 && (range.offset > mFile.size() || range.bytes > mFile.size() - range.offset)))
+        throw runtime_error(filename + " is truncated or corrupt");
+    }
+  }
+
+  const PointCacheHeader &header() const { return *mHeader; }
+
+  /// Start of a section in the mapping, null when it is empty; bytes receives its size.
+  const void *section(PointCacheSection section, size_t &bytes) const
+  {
+    const PointCacheRange &range = mHeader->sections[section];
+    bytes = size_t(range.bytes);
+    return range.bytes > 0 ? mFile.data() + range.offset : nullptr;
+  }
+
+  void info(PointCacheInfo &info) const
+  {
+    info.version = mHeader->version;
+    info.pointCount = mHeader->pointCount;
+    info.leafCount = mHeader->leafCount;
+    info.voxelSize = float(mHeader->voxelSize);
+    for (int i = 0; i < 16; ++i)
+      info.indexToWorld[i] = float(mHeader->indexToWorld[i]);
+    for (int c = 0; c < 3; ++c)
+    {
+      info.boundsMin[c] = mHeader->boundsMin[c];
+      info.boundsMax[c] = mHeader->boundsMax[c];
+    }
+    info.hasColors = mHeader->sections[PointCacheColors].bytes > 0;
+  }
+
+private:
+  MappedFile mFile;
+  const PointCacheHeader *mHeader;
+};
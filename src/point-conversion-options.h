@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+enum PositionCodec
+{
+  PositionFloat = 0,   // NullCodec, 32 bit float per component
+  PositionFixed16 = 1, // FixedPointCodec<false>, 16 bit voxel relative
+  PositionFixed8 = 2,  // FixedPointCodec<true>, 8 bit voxel relative
+  PositionHalf = 3     // TruncateCodec, 16 bit float
+};
+
+enum ColorCodec
+{
+  ColorUnitRange16 = 0, // FixedPointCodec<false, UnitRange>
+  ColorUnitRange8 = 1   // FixedPointCodec<true, UnitRange>, one byte per channel
+};
+
+enum FileCompression
+{
+  FileCompressionDefault = 0, // whatever io::File picks, Blosc when it is available
+  FileCompressionNone = 1,
+  FileCompressionZip = 2,
+  FileCompressionBlosc = 3 // falls back to Zip when OpenVDB was built without Blosc
+};
+
+struct PointConversionOptions
+{
+  PositionCodec positionCodec;
+  ColorCodec colorCodec;
+  FileCompression compression;
+  int lodLevels;       // coarser point grids to write next to the points, see appendPointLODGrids
+  size_t memoryBudget; // 0 reads the whole cloud, otherwise converts in batches of about this many bytes
+  int levelSetQuality; // 0 for none, or a SampleQuality to rasterize at and store as Points_SDF_<quality>;
+                       // rasterizing needs every point at once, so it must be 0 with a memoryBudget
+};
+
+struct PointConversionReport
+{
+  uint64_t pointCount;
+  uint64_t bytesWritten;
+  double encodeSeconds; // building the point grids, including codecs and LOD levels
+  double writeSeconds;  // io::File::write, including file compression
+};
+
+inline PointConversionOptions defaultPointConversionOptions()
+{
+  PointConversionOptions options;
+  options.positionCodec = PositionFloat;
+  options.colorCodec = ColorUnitRange16;
+  options.compression = FileCompressionDefault;
+  options.lodLevels = 0;
+  options.memoryBudget = 0;
+  options.levelSetQuality = 0;
+  return options;
+}
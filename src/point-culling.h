@@ -0,0 +1,304 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+using namespace std;
+
+enum LeafVisibility : uint8_t
+{
+  LeafOutside = 0,
+  LeafIntersecting = 1,
+  LeafInside = 2
+};
+
+/// Index space bounds of every leaf in LeafManager order, stored as SoA origins. Points may sit
+/// half a voxel outside their voxel, so each leaf spans [origin - 0.5, origin + DIM - 0.5].
+struct LeafBoundsTable
+{
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  vector<const LeafT *> leaves;
+  vector<float> x, y, z;
+  /// Largest distance from the index space origin to any leaf corner.
+  float radius;
+
+  LeafBoundsTable() : radius(0.0f) {}
+
+  static float halfExtent() { return 0.5f * float(openvdb::points::PointDataTree::LeafNodeType::DIM); }
+
+  size_t size() const { return x.size(); }
+
+  /// Empty the table in place, so cull states that hold it see the rebuild.
+  void clear()
+  {
+    leaves.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+    radius = 0.0f;
+  }
+
+  void build(const openvdb::points::PointDataTree &tree)
+  {
+    openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(tree);
+    const size_t count = leafManager.leafCount();
+    leaves.resize(count);
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    leafManager.foreach([&](const LeafT &leaf, size_t idx) {
+      const openvdb::Coord &origin = leaf.origin();
+      leaves[idx] = &leaf;
+      x[idx] = float(origin.x()) - 0.5f;
+      y[idx] = float(origin.y()) - 0.5f;
+      z[idx] = float(origin.z()) - 0.5f;
+    });
+    const openvdb::CoordBBox bbox = tree.evalActiveVoxelBoundingBox();
+    const float dim = float(LeafT::DIM);
+    radius = 0.0f;
+    for (int c = 0; c < 8; ++c)
+    {
+      const openvdb::Vec3f corner(float(c & 1 ? bbox.max().x() + dim : bbox.min().x() - dim),
+                                  float(c & 2 ? bbox.max().y() + dim : bbox.min().y() - dim),
+                                  float(c & 4 ? bbox.max().z() + dim : bbox.min().z() - dim));
+      radius = max(radius, corner.length());
+    }
+  }
+};
+
+/// Plane n.p + d >= 0 on the inside, normalized so d and distances are in index units.
+struct IndexPlane
+{
+  float n[3], d;
+};
+
+/// Convert world planes (nx, ny, nz, d, inside where n.p + d >= 0, as Unity's
+/// GeometryUtility.CalculateFrustumPlanes produces) to index space. Requires a linear transform.
+/// Non-linear transforms yield no planes, which classifies every leaf as inside.
+inline vector<IndexPlane> worldToIndexPlanes(const float *planes, size_t planeCount, const openvdb::math::Transform &transform)
+{
+  if (!transform.isLinear())
+    return vector<IndexPlane>();
+  const openvdb::Mat4d mat = transform.baseMap()->getAffineMap()->getMat4();
+  vector<IndexPlane> result(planeCount);
+  for (size_t p = 0; p < planeCount; ++p)
+  {
+    double n[3] = {0.0, 0.0, 0.0};
+    double d = planes[p * 4 + 3];
+    // world = index * mat for row vectors, so n.world = sum_j index_j * (sum_c mat[j][c] * n_c)
+    for (int j = 0; j < 3; ++j)
+    {
+      for (int c = 0; c < 3; ++c)
+        n[j] += mat[j][c] * planes[p * 4 + c];
+    }
+    for (int c = 0; c < 3; ++c)
+      d += mat[3][c] * planes[p * 4 + c];
+    const double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    const double scale = length > 0.0 ? 1.0 / length : 0.0;
+    for (int j = 0; j < 3; ++j)
+      result[p].n[j] = float(n[j] * scale);
+    result[p].d = float(d * scale);
+  }
+  return result;
+}
+
+/// Six planes bounding a world space box.
+inline vector<IndexPlane> worldBoxToIndexPlanes(const float *boxMin, const float *boxMax, const openvdb::math::Transform &transform)
+{
+  float planes[24] = {0.0f};
+  for (int c = 0; c < 3; ++c)
+  {
+    planes[c * 8 + c] = 1.0f;
+    planes[c * 8 + 3] = -boxMin[c];
+    planes[c * 8 + 4 + c] = -1.0f;
+    planes[c * 8 + 7] = boxMax[c];
+  }
+  return worldToIndexPlanes(planes, 6, transform);
+}
+
+/// Classify one leaf box against all planes. slack receives how far the planes can move before the
+/// classification may change: the inside margin for inside leaves, the margin behind the most
+/// separating plane for outside leaves, and zero for intersecting leaves.
+inline LeafVisibility classifyLeaf(const LeafBoundsTable &table, size_t idx, const vector<IndexPlane> &planes, float &slack)
+{
+  const float h = LeafBoundsTable::halfExtent();
+  const float cx = table.x[idx] + h, cy = table.y[idx] + h, cz = table.z[idx] + h;
+  float insideMargin = numeric_limits<float>::max();
+  bool intersecting = false;
+  for (size_t p = 0; p < planes.size(); ++p)
+  {
+    const IndexPlane &plane = planes[p];
+    const float s = plane.n[0] * cx + plane.n[1] * cy + plane.n[2] * cz + plane.d;
+    const float r = h * (fabs(plane.n[0]) + fabs(plane.n[1]) + fabs(plane.n[2]));
+    if (s < -r)
+    {
+      slack = -s - r;
+      // keep the most separating plane
+      for (++p; p < planes.size(); ++p)
+      {
+        const IndexPlane &other = planes[p];
+        const float so = other.n[0] * cx + other.n[1] * cy + other.n[2] * cz + other.d;
+        const float ro = h * (fabs(other.n[0]) + fabs(other.n[1]) + fabs(other.n[2]));
+        slack = max(slack, -so - ro);
+      }
+      return LeafOutside;
+    }
+    if (s < r)
+      intersecting = true;
+    insideMargin = min(insideMargin, s - r);
+  }
+  slack = intersecting ? 0.0f : insideMargin;
+  return intersecting ? LeafIntersecting : LeafInside;
+}
+
+/// Classify leaves [begin, end) of ids (or of the table when ids is null) in parallel.
+inline void classifyLeaves(const LeafBoundsTable &table, const vector<IndexPlane> &planes, const uint32_t *ids,
+                           size_t begin, size_t end, uint8_t *flags, float *slack)
+{
+  tbb::parallel_for(tbb::blocked_range<size_t>(begin, end, 4096), [&](const tbb::blocked_range<size_t> &range) {
+    float unused;
+    for (size_t i = range.begin(); i < range.end(); ++i)
+    {
+      const size_t idx = ids ? ids[i] : i;
+      flags[idx] = classifyLeaf(table, idx, planes, slack ? slack[idx] : unused);
+    }
+  });
+}
+
+/// True if an index space point is on the inside of every plane.
+inline bool insidePlanes(const vector<IndexPlane> &planes, float x, float y, float z)
+{
+  for (size_t p = 0; p < planes.size(); ++p)
+  {
+    if (planes[p].n[0] * x + planes[p].n[1] * y + planes[p].n[2] * z + planes[p].d < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+/// Write the ids of visible leaves into out, up to capacity. Returns the number of visible leaves.
+inline size_t compactVisibleLeaves(const vector<uint8_t> &flags, uint32_t *out, size_t capacity)
+{
+  size_t count = 0;
+  for (size_t idx = 0, e = flags.size(); idx < e; ++idx)
+  {
+    if (flags[idx] == LeafOutside)
+      continue;
+    if (count < capacity)
+      out[count] = uint32_t(idx);
+    ++count;
+  }
+  return count;
+}
+
+/// Frame to frame culling state. A full test records each leaf's slack and buckets leaves by it;
+/// later frames bound how far every plane has moved since then and only re-test the buckets whose
+/// slack is within that bound, falling back to a full test once too many leaves qualify.
+class FrustumCullState
+{
+public:
+  static const int BUCKETS = 32;
+
+  explicit FrustumCullState(const LeafBoundsTable &table) : mTable(table), mValid(false), mRetested(0) {}
+
+  const vector<uint8_t> &flags() const { return mFlags; }
+
+  /// Update leaf visibility for planes, already in index space.
+  void update(const vector<IndexPlane> &planes)
+  {
+    const size_t leafCount = mTable.size();
+    if (!mValid || planes.size() != mPlanes.size() || mFlags.size() != leafCount)
+      return this->fullTest(planes);
+
+    const float extent = LeafBoundsTable::halfExtent() * sqrt(3.0f);
+    float drift = 0.0f;
+    for (size_t p = 0; p < planes.size(); ++p)
+    {
+      const float dx = planes[p].n[0] - mPlanes[p].n[0];
+      const float dy = planes[p].n[1] - mPlanes[p].n[1];
+      const float dz = planes[p].n[2] - mPlanes[p].n[2];
+      const float dn = sqrt(dx * dx + dy * dy + dz * dz);
+      drift = max(drift, dn * (mTable.radius + extent) + fabs(planes[p].d - mPlanes[p].d));
+    }
+    int bucket = 0;
+    while (bucket < BUCKETS && bucketFloor(bucket) <= drift)
+      ++bucket;
+    const size_t retest = mBucketOffsets[bucket];
+    if (retest > leafCount / 4)
+      return this->fullTest(planes);
+    // leaves re-tested last frame but not this one go back to their classification from the full test
+    for (size_t i = retest; i < mRetested; ++i)
+      mFlags[mBucketLeaves[i]] = mBaseFlags[mBucketLeaves[i]];
+    classifyLeaves(mTable, planes, mBucketLeaves.data(), 0, retest, mFlags.data(), nullptr);
+    mRetested = retest;
+  }
+
+private:
+  /// Smallest slack stored in a bucket: 0 for the first, then powers of two from 1/16 voxel.
+  static float bucketFloor(int bucket) { return bucket == 0 ? 0.0f : ldexp(1.0f, bucket - 5); }
+
+  static int bucketOf(float slack)
+  {
+    int bucket = 0;
+    while (bucket + 1 < BUCKETS && bucketFloor(bucket + 1) <= slack)
+      ++bucket;
+    return bucket;
+  }
+
+  void fullTest(const vector<IndexPlane> &planes)
+  {
+    const size_t leafCount = mTable.size();
+    mPlanes = planes;
+    mFlags.resize(leafCount);
+    mSlack.resize(leafCount);
+    classifyLeaves(mTable, planes, nullptr, 0, leafCount, mFlags.data(), mSlack.data());
+
+    // counting sort by bucket so re-tests walk a prefix of mBucketLeaves
+    vector<size_t> counts(BUCKETS + 1, 0);
+    vector<uint8_t> buckets(leafCount);
+    for (size_t idx = 0; idx < leafCount; ++idx)
+    {
+      buckets[idx] = uint8_t(bucketOf(mSlack[idx]));
+      ++counts[buckets[idx] + 1];
+    }
+    for (int b = 0; b < BUCKETS; ++b)
+      counts[b + 1] += counts[b];
+    mBucketOffsets = counts;
+    mBucketLeaves.resize(leafCount);
+    for (size_t idx = 0; idx < leafCount; ++idx)
+      mBucketLeaves[counts[buckets[idx]]++] = uint32_t(idx);
+    mBaseFlags = mFlags;
+    mRetested = 0;
+    mValid = true;
+  }
+
+  const LeafBoundsTable &mTable;
+  bool mValid;
+  size_t mRetested;
+  vector<IndexPlane> mPlanes;
+  vector<uint8_t> mFlags, mBaseFlags;
+  vector<float> mSlack;
+  vector<size_t> mBucketOffsets;
+  vector<uint32_t> mBucketLeaves;
+};
+
+class SharedPointDataGridReference;
+
+/// Culling state handed out through the C API, with the transform its world planes are mapped through
+/// and the reference whose bounds table it tests, rebuilt through it after appends.
+struct FrustumCullHandle
+{
+  openvdb::math::Transform::ConstPtr transform;
+  SharedPointDataGridReference *reference;
+  FrustumCullState state;
+
+  FrustumCullHandle(openvdb::math::Transform::ConstPtr xform, SharedPointDataGridReference *ref, const LeafBoundsTable &table)
+      : transform(xform), reference(ref), state(table) {}
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+using namespace std;
+
+enum PointBufferLayout
+{
+    Interleaved = 0, // xyz xyz xyz ...
+    Planar = 1       // xxx ... yyy ... zzz ...
+};
+
+enum PointBufferFormat
+{
+    Float32 = 0,
+    Float16 = 1,
+    UNorm16 = 2, // quantized against a per component range
+    UNorm8 = 3
+};
+
+/// IEEE 754 single to half precision with round to nearest even.
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t absBits = bits & 0x7fffffffu;
+    if (absBits >= 0x7f800000u) // inf or nan
+        return uint16_t(sign | 0x7c00u | (absBits > 0x7f800000u ? 0x200u : 0u));
+    if (absBits >= 0x477ff000u) // rounds past the largest half
+        return uint16_t(sign | 0x7c00u);
+    if (absBits < 0x38800000u) // half denormal or zero
+    {
+        if (absBits < 0x33000000u)
+            return uint16_t(sign);
+        const uint32_t mantissa = (absBits & 0x007fffffu) | 0x00800000u;
+        const uint32_t shift = 126u - (absBits >> 23);
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+        const uint32_t halfway = 1u << (shift - 1u);
+        if (remainder > halfway || (remainder == halfway && (half & 1u)))
+            ++half;
+        return uint16_t(sign | half);
+    }
+    uint32_t half = ((absBits - 0x38000000u) >> 13);
+    const uint32_t remainder = absBits & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+        ++half;
+    return uint16_t(sign | half);
+}
+
+struct Float32Encoder
+{
+    typedef float StorageType;
+    float operator()(float value, int /*component*/) const { return value; }
+};
+
+struct Float16Encoder
+{
+    typedef uint16_t StorageType;
+    uint16_t operator()(float value, int /*component*/) const { return floatToHalf(value); }
+};
+
+/// Maps [minimum, minimum + extent] of each component onto the full integer range.
+template <typename IntT>
+struct UNormEncoder
+{
+    typedef IntT StorageType;
+    float offset[3], scale[3];
+
+    UNormEncoder(const float *minimum, const float *maximum)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            const float extent = maximum[c] - minimum[c];
+            offset[c] = minimum[c];
+            scale[c] = extent > 0.0f ? float(IntT(~IntT(0))) / extent : 0.0f;
+        }
+    }
+    IntT operator()(float value, int component) const
+    {
+        float v = (value - offset[component]) * scale[component] + 0.5f;
+        const float top = float(IntT(~IntT(0)));
+        v = v < 0.0f ? 0.0f : (v > top ? top : v);
+        return IntT(v);
+    }
+};
+
+/// Encode count points held as SoA x, y, z into out at point index begin of total points.
+template <typename EncoderT>
+inline void writeEncodedComponents(const float *x, const float *y, const float *z, size_t count,
+                                   size_t begin, size_t total, PointBufferLayout layout,
+                                   const EncoderT &encoder, typename EncoderT::StorageType *out)
+{
+    if (layout == Planar)
+    {
+        typename EncoderT::StorageType *outX = out + begin, *outY = outX + total, *outZ = outY + total;
+        for (size_t n = 0; n < count; ++n)
+        {
+            outX[n] = encoder(x[n], 0);
+            outY[n] = encoder(y[n], 1);
+            outZ[n] = encoder(z[n], 2);
+        }
+        return;
+    }
+    typename EncoderT::StorageType *dst = out + begin * 3;
+    for (size_t n = 0; n < count; ++n, dst += 3)
+    {
+        dst[0] = encoder(x[n], 0);
+        dst[1] = encoder(y[n], 1);
+        dst[2] = encoder(z[n], 2);
+    }
+}
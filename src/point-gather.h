@@ -0,0 +1,130 @@
+#pragma once
+#include <vector>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+using namespace std;
+
+/// Single precision index-to-world map for linear transforms, applied in place to SoA buffers.
+/// The loop has no dependencies between points so the compiler vectorizes it.
+class AffineIndexToWorld
+{
+public:
+  explicit AffineIndexToWorld(const openvdb::math::Transform &transform)
+      : mLinear(transform.isLinear()), mTransform(transform)
+  {
+    const openvdb::Mat4d mat = transform.baseMap()->getAffineMap()->getMat4();
+    // openvdb matrices act on row vectors, so mRow[i] holds column i of mat
+    for (int i = 0; i < 3; ++i)
+    {
+      for (int j = 0; j < 4; ++j)
+        mRow[i][j] = float(mat[j][i]);
+    }
+  }
+
+  bool isLinear() const { return mLinear; }
+
+  void apply(float *__restrict x, float *__restrict y, float *__restrict z, size_t count) const
+  {
+    if (!mLinear)
+    {
+      for (size_t n = 0; n < count; ++n)
+      {
+        const openvdb::Vec3d xyz = mTransform.indexToWorld(openvdb::Vec3d(x[n], y[n], z[n]));
+        x[n] = float(xyz.x());
+        y[n] = float(xyz.y());
+        z[n] = float(xyz.z());
+      }
+      return;
+    }
+    const float m00 = mRow[0][0], m01 = mRow[0][1], m02 = mRow[0][2], m03 = mRow[0][3];
+    const float m10 = mRow[1][0], m11 = mRow[1][1], m12 = mRow[1][2], m13 = mRow[1][3];
+    const float m20 = mRow[2][0], m21 = mRow[2][1], m22 = mRow[2][2], m23 = mRow[2][3];
+    for (size_t n = 0; n < count; ++n)
+    {
+      const float i = x[n], j = y[n], k = z[n];
+      x[n] = m00 * i + m01 * j + m02 * k + m03;
+      y[n] = m10 * i + m11 * j + m12 * k + m13;
+      z[n] = m20 * i + m21 * j + m22 * k + m23;
+    }
+  }
+
+private:
+  bool mLinear;
+  const openvdb::math::Transform &mTransform;
+  float mRow[3][4];
+};
+
+/// Exclusive prefix sum of active point counts in LeafManager order. The result has one more
+/// entry than there are leaves; the last entry is the total point count.
+inline vector<openvdb::Index64> computeLeafPointOffsets(const openvdb::points::PointDataTree &tree)
+{
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(tree);
+  vector<openvdb::Index64> offsets(leafManager.leafCount() + 1, 0);
+  leafManager.foreach([&offsets](const LeafT &leaf, size_t idx) {
+    offsets[idx + 1] = leaf.onPointCount();
+  });
+  for (size_t i = 1; i < offsets.size(); ++i)
+    offsets[i] += offsets[i - 1];
+  return offsets;
+}
+
+/// Decode "P" of every active point in one leaf to index space, writing into x, y, z.
+inline void decodeLeafIndexPositions(const openvdb::points::PointDataTree::LeafNodeType &leaf,
+                                     float *x, float *y, float *z)
+{
+  openvdb::points::AttributeHandle<openvdb::Vec3f> positionHandle(leaf.constAttributeArray("P"));
+  size_t n = 0;
+  for (auto indexIter = leaf.beginIndexOn(); indexIter; ++indexIter, ++n)
+  {
+    const openvdb::Vec3f voxelPos = positionHandle.get(*indexIter);
+    const openvdb::Coord ijk = indexIter.getCoord();
+    x[n] = voxelPos.x() + float(ijk.x());
+    y[n] = voxelPos.y() + float(ijk.y());
+    z[n] = voxelPos.z() + float(ijk.z());
+  }
+}
+
+/// Decode a Vec3f attribute such as "Cd" for every active point in one leaf, writing into x, y, z.
+inline void decodeLeafVec3Attribute(const openvdb::points::PointDataTree::LeafNodeType &leaf, size_t attributeIndex,
+                                    float *x, float *y, float *z)
+{
+  openvdb::points::AttributeHandle<openvdb::Vec3f> handle(leaf.constAttributeArray(attributeIndex));
+  size_t n = 0;
+  for (auto indexIter = leaf.beginIndexOn(); indexIter; ++indexIter, ++n)
+  {
+    const openvdb::Vec3f value = handle.get(*indexIter);
+    x[n] = value.x();
+    y[n] = value.y();
+    z[n] = value.z();
+  }
+}
+
+/// World space bounds of all points; positions may sit up to half a voxel outside active voxels.
+inline openvdb::BBoxd computeWorldPointBounds(const openvdb::points::PointDataGrid &grid)
+{
+  const openvdb::CoordBBox active = grid.evalActiveVoxelBoundingBox();
+  if (active.empty())
+    return openvdb::BBoxd(openvdb::Vec3d(0.0), openvdb::Vec3d(0.0));
+  const openvdb::BBoxd index(active.min().asVec3d() - openvdb::Vec3d(0.5), active.max().asVec3d() + openvdb::Vec3d(0.5));
+  return grid.transform().indexToWorld(index);
+}
+
+/// Gather world space positions of all active points into SoA buffers, in parallel over leaves.
+/// offsets must come from computeLeafPointOffsets for the same tree.
+inline void gatherWorldPositions(const openvdb::points::PointDataGrid &grid, const vector<openvdb::Index64> &offsets,
+                                 float *x, float *y, float *z)
+{
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  const AffineIndexToWorld indexToWorld(grid.transform());
+  openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(grid.tree());
+  leafManager.foreach([&](const LeafT &leaf, size_t idx) {
+    const size_t begin = offsets[idx], count = offsets[idx + 1] - begin;
+    decodeLeafIndexPositions(leaf, x + begin, y + begin, z + begin);
+    indexToWorld.apply(x + begin, y + begin, z + begin, count);
+  });
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <openvdb/openvdb.h>
+#include <openvdb/io/File.h>
+#include <openvdb/points/PointDataGrid.h>
+
+using namespace std;
+
+/// Absolute path of an existing file with links and dot segments resolved, so one file opened
+/// through different spellings is one cache entry. Paths that can't be resolved are kept as given.
+inline string canonicalPath(const string &filename)
+{
+#ifdef _WIN32
+  char *resolved = _fullpath(nullptr, filename.c_str(), 0);
+#else
+  char *resolved = realpath(filename.c_str(), nullptr);
+#endif
+  if (!resolved)
+    return filename;
+  const string path(resolved);
+  free(resolved);
+  return path;
+}
+
+struct PointGridOpenOptions
+{
+  bool delayLoad; // leave leaf attribute buffers in the mapped file until they are touched
+  bool useBBox;   // only read leaves intersecting [bboxMin, bboxMax], in world space
+  float bboxMin[3];
+  float bboxMax[3];
+  bool useCache; // share one grid between every open of the same file, grid and region
+};
+
+inline PointGridOpenOptions defaultPointGridOpenOptions()
+{
+  PointGridOpenOptions options;
+  options.delayLoad = true;
+  options.useBBox = false;
+  for (int c = 0; c < 3; ++c)
+    options.bboxMin[c] = options.bboxMax[c] = 0.0f;
+  options.useCache = true;
+  return options;
+}
+
+/// Process wide cache of opened point grids keyed by path, grid name and read region. Each grid is
+/// handed out through a pointer that also owns the io::File it was read from, so the file stays open
+/// for delayed loading until the last reference is released; the cache itself only keeps weak
+/// pointers, so released grids are freed rather than pinned.
+class PointGridCache
+{
+public:
+  static PointGridCache &instance()
+  {
+    static PointGridCache cache;
+    return cache;
+  }
+
+  openvdb::points::PointDataGrid::Ptr acquire(const string &filename, const string &gridName, const PointGridOpenOptions &options)
+  {
+    if (!options.useCache)
+      return open(filename, gridName, options);
+    const string key = makeKey(filename, gridName, options);
+    {
+      lock_guard<mutex> lock(mMutex);
+      auto it = mGrids.find(key);
+      if (it != mGrids.end())
+      {
+        openvdb::points::PointDataGrid::Ptr grid = it->second.lock();
+        if (grid)
+          return grid;
+      }
+    }
+    // read outside the lock; if two callers race, the first one to insert wins
+    openvdb::points::PointDataGrid::Ptr grid = open(filename, gridName, options);
+    lock_guard<mutex> lock(mMutex);
+    weak_ptr<openvdb::points::PointDataGrid> &entry = mGrids[key];
+    openvdb::points::PointDataGrid::Ptr existing = entry.lock();
+    if (existing)
+      return existing;
+    entry = grid;
+    return grid;
+  }
+
+  /// Forget the entries handing out grid, before it is changed in place; later opens read the file again.
+  void forget(const openvdb::points::PointDataGrid &grid)
+  {
+    lock_guard<mutex> lock(mMutex);
+    for (auto it = mGrids.begin(); it != mGrids.end();)
+    {
+      if (it->second.lock().get() == &grid)
+        it = mGrids.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  /// Forget entries whose grids have been released.
+  void prune()
+  {
+    lock_guard<mutex> lock(mMutex);
+    for (auto it = mGrids.begin(); it != mGrids.end();)
+    {
+      if (it->second.expired())
+        it = mGrids.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  size_t size()
+  {
+    this->prune();
+    lock_guard<mutex> lock(mMutex);
+    return mGrids.size();
+  }
+
+private:
+  struct OpenGrid
+  {
+    unique_ptr<openvdb::io::File> file;
+    openvdb::points::PointDataGrid::Ptr grid;
+  };
+
+  static string makeKey(const string &filename, const string &gridName, const PointGridOpenOptions &options)
+  {
+    ostringstream key;
+    key << canonicalPath(filename) << '\n' << gridName << '\n' << options.delayLoad;
+    if (options.useBBox)
+    {
+      // nine significant digits round trip any float, so distinct boxes never share a key
+      key << setprecision(9);
+      for (int c = 0; c < 3; ++c)
+        key << ' ' << options.bboxMin[c] << ' ' << options.bboxMax[c];
+    }
+    return key.str();
+  }
+
+  static openvdb::points::PointDataGrid::Ptr open(const string &filename, const string &gridName, const PointGridOpenOptions &options)
+  {
+    shared_ptr<OpenGrid> handle(new OpenGrid());
+    handle->file.reset(new openvdb::io::File(filename));
+    handle->file->open(options.delayLoad);
+    openvdb::GridBase::Ptr base;
+    if (options.useBBox)
+    {
+      const openvdb::BBoxd bbox(openvdb::Vec3d(options.bboxMin[0], options.bboxMin[1], options.bboxMin[2]),
+                                openvdb::Vec3d(options.bboxMax[0], options.bboxMax[1], options.bboxMax[2]));
+      base = handle->file->readGrid(gridName, bbox);
+    }
+    else
+    {
+      base = handle->file->readGrid(gridName);
+    }
+    handle->grid = openvdb::gridPtrCast<openvdb::points::PointDataGrid>(base);
+    if (!handle->grid)
+      throw runtime_error(gridName + " in " + filename + " is not a PointDataGrid");
+    if (!options.delayLoad)
+      handle->file->close();
+    // alias the grid so that the file lives exactly as long as the grid is referenced
+    return openvdb::points::PointDataGrid::Ptr(handle, handle->grid.get());
+  }
+
+  mutex mMutex;
+  map<string, weak_ptr<openvdb::points::PointDataGrid>> mGrids;
+};
@@ -0,0 +1,261 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include "point-metrics.h"
+
+using namespace std;
+
+enum PointJobStatus
+{
+  JobInvalid = -1, // unknown or released id
+  JobPending = 0,
+  JobRunning = 1,
+  JobSucceeded = 2,
+  JobFailed = 3,
+  JobCancelled = 4
+};
+
+class JobCancelledError : public runtime_error
+{
+public:
+  JobCancelledError() : runtime_error("Job cancelled") {}
+};
+
+/// Interrupter handed to the OpenVDB tools a job runs. Work is split into stages that each own a
+/// slice of [0, 1]; progress reported inside a stage, by the tools or by our own loops, is mapped
+/// into that slice. Cancelling sets the flag the tools poll.
+class JobInterrupter
+{
+public:
+  JobInterrupter() : mCancelled(false), mProgress(0.0f), mStage(packStage(0.0f, 1.0f)) {}
+
+  // OpenVDB interrupter interface
+  void start(const char * = nullptr) {}
+  void end() {}
+  bool wasInterrupted(int percent = -1)
+  {
+    if (percent >= 0)
+      this->setStageProgress(min(percent, 100) / 100.0f);
+    return this->cancelled();
+  }
+
+  void beginStage(float begin, float end)
+  {
+    mStage.store(packStage(begin, end), memory_order_relaxed);
+    mProgress.store(begin, memory_order_relaxed);
+  }
+  /// Called from tool worker threads while the job thread may begin the next stage; both bounds are
+  /// read in one load so a stage is never seen half updated.
+  void setStageProgress(float fraction)
+  {
+    const uint64_t stage = mStage.load(memory_order_relaxed);
+    const float begin = stageBound(uint32_t(stage)), end = stageBound(uint32_t(stage >> 32));
+    mProgress.store(begin + (end - begin) * fraction, memory_order_relaxed);
+  }
+  float progress() const { return mProgress.load(memory_order_relaxed); }
+
+  void cancel() { mCancelled.store(true); }
+  bool cancelled() const { return mCancelled.load(memory_order_relaxed); }
+  /// Stop between steps that can't be interrupted from inside.
+  void checkpoint() const
+  {
+    if (this->cancelled())
+      throw JobCancelledError();
+  }
+
+private:
+  static uint64_t packStage(float begin, float end)
+  {
+    uint32_t b, e;
+    memcpy(&b, &begin, sizeof(b));
+    memcpy(&e, &end, sizeof(e));
+    return uint64_t(b) | (uint64_t(e) << 32);
+  }
+  static float stageBound(uint32_t bits)
+  {
+    float bound;
+    memcpy(&bound, &bits, sizeof(bound));
+    return bound;
+  }
+
+  atomic<bool> mCancelled;
+  atomic<float> mProgress;
+  atomic<uint64_t> mStage; // begin in the low 32 bits, end in the high, as float bits
+};
+
+/// Report stage progress and stop if cancelled, when an interrupter is attached.
+inline void jobCheckpoint(JobInterrupter *interrupter, float stageFraction)
+{
+  if (!interrupter)
+    return;
+  interrupter->setStageProgress(stageFraction);
+  interrupter->checkpoint();
+}
+
+/// A unit of background work. Subclasses implement run() and keep their result until it is collected.
+class PointJob
+{
+public:
+  JobInterrupter interrupter;
+  /// Everything the job recorded, unless it records into a reference instead.
+  PointMetrics metrics;
+
+  PointJob() : mStatus(JobPending), mGroup(nullptr) {}
+  virtual ~PointJob() {}
+
+  PointJobStatus status() const { return PointJobStatus(mStatus.load()); }
+
+  string message()
+  {
+    lock_guard<mutex> lock(mMutex);
+    return mMessage;
+  }
+
+  void setMessage(const string &message)
+  {
+    lock_guard<mutex> lock(mMutex);
+    mMessage = message;
+  }
+
+  /// Stop the job: the tools see the interrupter flag, and cancelling the task group drops any
+  /// parallel work that has not started yet, including work inside tools without an interrupter.
+  void cancel()
+  {
+    interrupter.cancel();
+    lock_guard<mutex> lock(mMutex);
+    if (mGroup)
+      mGroup->cancel();
+  }
+
+  /// Run the job in its own task group, on the calling arena thread.
+  void execute()
+  {
+    if (interrupter.cancelled())
+    {
+      mStatus = JobCancelled;
+      return;
+    }
+    mStatus = JobRunning;
+    tbb::task_group group;
+    {
+      lock_guard<mutex> lock(mMutex);
+      mGroup = &group;
+    }
+    PointJobStatus status = JobSucceeded;
+    group.run_and_wait([&] {
+      PointMetricsScope metricsScope(&metrics);
+      try
+      {
+        this->run();
+      }
+      catch (exception &e)
+      {
+        status = interrupter.cancelled() ? JobCancelled : JobFailed;
+        this->setMessage(e.what());
+      }
+    });
+    {
+      lock_guard<mutex> lock(mMutex);
+      mGroup = nullptr;
+    }
+    // run() checkpoints after each parallel step, so a run that returned was not cut short
+    if (status == JobSucceeded)
+      interrupter.beginStage(1.0f, 1.0f);
+    mStatus = status;
+  }
+
+protected:
+  virtual void run() = 0;
+
+private:
+  atomic<int> mStatus;
+  mutex mMutex;
+  string mMessage;
+  tbb::task_group *mGroup;
+};
+
+/// Process wide job registry and the task arena jobs run on, kept apart from the default arena so
+/// jobs can't take every core from the host application.
+class PointJobManager
+{
+public:
+  static PointJobManager &instance()
+  {
+    static PointJobManager manager;
+    return manager;
+  }
+
+  /// Set the arena's thread count, 0 for all cores but one. Fails while a job is pending or running.
+  bool setConcurrency(int threads)
+  {
+    lock_guard<mutex> lock(mMutex);
+    // released jobs still count until their task returns
+    if (mActive.load() > 0)
+      return false;
+    mConcurrency = threads;
+    mArena.reset();
+    return true;
+  }
+
+  int submit(const shared_ptr<PointJob> &job)
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (!mArena)
+    {
+      const int threads = mConcurrency > 0 ? mConcurrency : max(tbb::this_task_arena::max_concurrency() - 1, 1);
+      // no slots reserved for an external thread: jobs are only ever enqueued
+      mArena.reset(new tbb::task_arena(threads, 0));
+    }
+    const int id = mNextId++;
+    mJobs[id] = job;
+    ++mActive;
+    shared_ptr<PointJob> running = job;
+    atomic<int> &active = mActive;
+    mArena->enqueue([running, &active] {
+      running->execute();
+      --active;
+    });
+    return id;
+  }
+
+  shared_ptr<PointJob> find(int id)
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mJobs.find(id);
+    return it == mJobs.end() ? shared_ptr<PointJob>() : it->second;
+  }
+
+  /// Forget a job. A job still running is cancelled and freed once its task returns.
+  void release(int id)
+  {
+    shared_ptr<PointJob> job;
+    {
+      lock_guard<mutex> lock(mMutex);
+      auto it = mJobs.find(id);
+      if (it == mJobs.end())
+        return;
+      job = it->second;
+      mJobs.erase(it);
+    }
+    job->cancel();
+  }
+
+private:
+  PointJobManager() : mNextId(1), mConcurrency(0), mActive(0) {}
+
+  mutex mMutex;
+  map<int, shared_ptr<PointJob>> mJobs;
+  int mNextId;
+  int mConcurrency;
+  atomic<int> mActive;
+  unique_ptr<tbb::task_arena> mArena;
+};
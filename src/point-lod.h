@@ -0,0 +1,271 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstring>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include <openvdb/points/PointConversion.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "point-gather.h"
+
+using namespace std;
+
+/// Position wrapper over world space Vec3f points for the point grid builders.
+class Vec3fPositionWrapper
+{
+public:
+  typedef openvdb::Vec3R PosType;
+  typedef openvdb::Vec3R value_type;
+
+  explicit Vec3fPositionWrapper(const vector<openvdb::Vec3f> &positions) : mPositions(positions) {}
+
+  size_t size() const { return mPositions.size(); }
+  void getPos(size_t n, openvdb::Vec3R &xyz) const { xyz = openvdb::Vec3R(mPositions[n]); }
+
+private:
+  const vector<openvdb::Vec3f> &mPositions;
+};
+
+/// Points of one cell of a coarse level: sums of index space positions and colors.
+struct PointCluster
+{
+  openvdb::Coord key;
+  openvdb::Vec3d position;
+  openvdb::Vec3f color;
+  uint32_t count;
+
+  PointCluster() : key(0), position(0.0), color(0.0f), count(0) {}
+};
+
+/// Representative points of one level, one per occupied cell of cellSize world units.
+struct PointLODLevel
+{
+  float cellSize;
+  vector<openvdb::Vec3f> positions;
+  vector<openvdb::Vec3f> colors; // empty when the grid has no "Cd"
+
+  PointLODLevel() : cellSize(0.0f) {}
+  size_t size() const { return positions.size(); }
+
+  /// Store the level as a point grid with about one point per voxel.
+  openvdb::points::PointDataGrid::Ptr toGrid(const string &name) const
+  {
+    using namespace openvdb::points;
+    openvdb::math::Transform::Ptr transform = openvdb::math::Transform::createLinearTransform(cellSize);
+    Vec3fPositionWrapper positionsWrapper(positions);
+    openvdb::tools::PointIndexGrid::Ptr pointIndex =
+        openvdb::tools::createPointIndexGrid<openvdb::tools::PointIndexGrid>(positionsWrapper, *transform);
+    PointDataGrid::Ptr grid = createPointDataGrid<FixedPointCodec<false, PositionRange>, PointDataGrid>(
+        *pointIndex, positionsWrapper, *transform);
+    if (!colors.empty())
+    {
+      appendAttribute<openvdb::Vec3f, FixedPointCodec<true, UnitRange>>(grid->tree(), "Cd");
+      PointAttributeVector<openvdb::Vec3f> colorWrapper(colors);
+      populateAttribute<PointDataTree, openvdb::tools::PointIndexTree, PointAttributeVector<openvdb::Vec3f>>(
+          grid->tree(), pointIndex->tree(), "Cd", colorWrapper);
+    }
+    grid->setName(name);
+    grid->insertMeta("lod_cell_size", openvdb::FloatMetadata(cellSize));
+    return grid;
+  }
+
+  /// Read a level written by toGrid.
+  void fromGrid(const openvdb::points::PointDataGrid &grid)
+  {
+    openvdb::FloatMetadata::ConstPtr meta = grid.getMetadata<openvdb::FloatMetadata>("lod_cell_size");
+    cellSize = meta ? meta->value() : float(grid.voxelSize()[0]);
+    const vector<openvdb::Index64> offsets = computeLeafPointOffsets(grid.tree());
+    const size_t count = offsets.back();
+    vector<float> x(count), y(count), z(count);
+    if (count > 0)
+      gatherWorldPositions(grid, offsets, x.data(), y.data(), z.data());
+    positions.resize(count);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, count), [&](const tbb::blocked_range<size_t> &range) {
+      for (size_t n = range.begin(); n < range.end(); ++n)
+        positions[n] = openvdb::Vec3f(x[n], y[n], z[n]);
+    });
+    colors.clear();
+    auto leafIter = grid.tree().cbeginLeaf();
+    if (!leafIter || leafIter->attributeSet().find("Cd") == openvdb::points::AttributeSet::INVALID_POS)
+      return;
+    colors.resize(count);
+    openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(grid.tree());
+    leafManager.foreach([&](const openvdb::points::PointDataTree::LeafNodeType &leaf, size_t idx) {
+      openvdb::points::AttributeHandle<openvdb::Vec3f> handle(leaf.constAttributeArray("Cd"));
+      size_t n = offsets[idx];
+      for (auto indexIter = leaf.beginIndexOn(); indexIter; ++indexIter)
+        colors[n++] = handle.get(*indexIter);
+    });
+  }
+};
+
+/// Progressively coarser point sets. Level l keeps one point per occupied cell of 2^(l+1) voxels, at
+/// the centroid of the cell's points with their average color. The first three levels fit inside a
+/// leaf and are built in parallel per leaf; coarser cells span leaves and are reduced from the level
+/// below by sorting on the cell key.
+class PointLODPyramid
+{
+public:
+  vector<PointLODLevel> levels;
+
+  void clear() { levels.clear(); }
+
+  void build(const openvdb::points::PointDataGrid &grid, int levelCount)
+  {
+    typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+    levels.clear();
+    if (levelCount <= 0)
+      return;
+    openvdb::tree::LeafManager<const openvdb::points::PointDataTree> leafManager(grid.tree());
+    auto leafIter = grid.tree().cbeginLeaf();
+    if (!leafIter)
+      return;
+    const size_t colorIndex = leafIter->attributeSet().find("Cd");
+    const bool hasColor = colorIndex != openvdb::points::AttributeSet::INVALID_POS;
+    const int leafLevels = min(levelCount, int(LeafT::LOG2DIM));
+
+    // levels inside a leaf
+    vector<vector<vector<PointCluster>>> perLeaf(leafLevels, vector<vector<PointCluster>>(leafManager.leafCount()));
+    tbb::enumerable_thread_specific<vector<float>> scratch;
+    leafManager.foreach([&](const LeafT &leaf, size_t idx) {
+      const size_t count = leaf.onPointCount();
+      vector<float> &buffer = scratch.local();
+      buffer.resize(count * 6);
+      float *x = buffer.data(), *y = x + count, *z = y + count;
+      float *r = z + count, *g = r + count, *b = g + count;
+      decodeLeafIndexPositions(leaf, x, y, z);
+      if (hasColor)
+        decodeLeafVec3Attribute(leaf, colorIndex, r, g, b);
+      PointCluster cells[LeafT::SIZE / 8];
+      for (int level = 1; level <= leafLevels; ++level)
+      {
+        const int dim = int(LeafT::DIM) >> level;
+        for (int c = 0; c < dim * dim * dim; ++c)
+          cells[c] = PointCluster();
+        size_t n = 0;
+        for (auto indexIter = leaf.beginIndexOn(); indexIter; ++indexIter, ++n)
+        {
+          const openvdb::Coord local = (indexIter.getCoord() - leaf.origin());
+          PointCluster &cell = cells[((local.x() >> level) * dim + (local.y() >> level)) * dim + (local.z() >> level)];
+          cell.position += openvdb::Vec3d(x[n], y[n], z[n]);
+          if (hasColor)
+            cell.color += openvdb::Vec3f(r[n], g[n], b[n]);
+          ++cell.count;
+        }
+        vector<PointCluster> &out = perLeaf[level - 1][idx];
+        for (int c = 0; c < dim * dim * dim; ++c)
+        {
+          if (cells[c].count == 0)
+            continue;
+          const openvdb::Coord local((c / (dim * dim)) << level, ((c / dim) % dim) << level, (c % dim) << level);
+          cells[c].key = openvdb::Coord((leaf.origin().x() + local.x()) >> level,
+                                        (leaf.origin().y() + local.y()) >> level,
+                                        (leaf.origin().z() + local.z()) >> level);
+          out.push_back(cells[c]);
+        }
+      }
+    });
+
+    vector<PointCluster> clusters;
+    const double voxelSize = grid.voxelSize()[0];
+    for (int level = 1; level <= levelCount; ++level)
+    {
+      if (level <= leafLevels)
+      {
+        clusters = concatenate(perLeaf[level - 1]);
+        vector<vector<PointCluster>>().swap(perLeaf[level - 1]);
+      }
+      else
+      {
+        const size_t previous = clusters.size();
+        clusters = coarsen(clusters);
+        if (clusters.size() == previous)
+          break;
+      }
+      levels.push_back(toLevel(clusters, grid.transform(), float(voxelSize * double(1 << level)), hasColor));
+      if (clusters.size() <= 1)
+        break;
+    }
+  }
+
+  /// Level to draw for a point budget and a tolerated world space error: the finest level whose
+  /// cell size is within the error, coarsened further until it fits the budget. -1 means the full
+  /// resolution points, which have no error.
+  int selectLevel(size_t fullCount, size_t pointBudget, float maxWorldError) const
+  {
+    int level = -1;
+    while (level + 1 < int(levels.size()) && levels[level + 1].cellSize <= maxWorldError)
+      ++level;
+    size_t count = level < 0 ? fullCount : levels[level].size();
+    while (count > pointBudget && level + 1 < int(levels.size()))
+      count = levels[++level].size();
+    return level;
+  }
+
+private:
+  static vector<PointCluster> concatenate(const vector<vector<PointCluster>> &parts)
+  {
+    vector<size_t> offsets(parts.size() + 1, 0);
+    for (size_t i = 0; i < parts.size(); ++i)
+      offsets[i + 1] = offsets[i] + parts[i].size();
+    vector<PointCluster> result(offsets.back());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, parts.size()), [&](const tbb::blocked_range<size_t> &range) {
+      for (size_t i = range.begin(); i < range.end(); ++i)
+        copy(parts[i].begin(), parts[i].end(), result.begin() + offsets[i]);
+    });
+    return result;
+  }
+
+  /// Merge clusters into cells twice their size.
+  static vector<PointCluster> coarsen(vector<PointCluster> clusters)
+  {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, clusters.size()), [&](const tbb::blocked_range<size_t> &range) {
+      for (size_t i = range.begin(); i < range.end(); ++i)
+      {
+        openvdb::Coord &key = clusters[i].key;
+        key = openvdb::Coord(key.x() >> 1, key.y() >> 1, key.z() >> 1);
+      }
+    });
+    tbb::parallel_sort(clusters.begin(), clusters.end(), [](const PointCluster &a, const PointCluster &b) {
+      return a.key.x() != b.key.x() ? a.key.x() < b.key.x()
+                                     : (a.key.y() != b.key.y() ? a.key.y() < b.key.y() : a.key.z() < b.key.z());
+    });
+    vector<PointCluster> result;
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+      if (result.empty() || result.back().key != clusters[i].key)
+      {
+        result.push_back(clusters[i]);
+        continue;
+      }
+      PointCluster &cell = result.back();
+      cell.position += clusters[i].position;
+      cell.color += clusters[i].color;
+      cell.count += clusters[i].count;
+    }
+    return result;
+  }
+
+  static PointLODLevel toLevel(const vector<PointCluster> &clusters, const openvdb::math::Transform &transform,
+                               float cellSize, bool hasColor)
+  {
+    PointLODLevel level;
+    level.cellSize = cellSize;
+    level.positions.resize(clusters.size());
+    level.colors.resize(hasColor ? clusters.size() : 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, clusters.size()), [&](const tbb::blocked_range<size_t> &range) {
+      for (size_t i = range.begin(); i < range.end(); ++i)
+      {
+        const double weight = 1.0 / double(clusters[i].count);
+        level.positions[i] = openvdb::Vec3f(transform.indexToWorld(clusters[i].position * weight));
+        if (hasColor)
+          level.colors[i] = clusters[i].color * float(weight);
+      }
+    });
+    return level;
+  }
+};
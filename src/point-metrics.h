@@ -0,0 +1,210 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+/// Every metric the library records. Timers accumulate nanoseconds, counters accumulate amounts,
+/// peaks keep the largest value seen.
+enum PointMetricId
+{
+  // timers
+  MetricReadPLY = 0,
+  MetricComputeVoxelSize,
+  MetricCreatePointIndexGrid,
+  MetricCreatePointDataGrid,
+  MetricPopulateAttribute,
+  MetricMergeGrids,
+  MetricBuildLOD,
+  MetricWriteFile,
+  MetricLoadGrid,
+  MetricGatherPoints,
+  MetricRasterize,
+  MetricResample,
+  MetricVolumeToMesh,
+  MetricExportPoints,
+  MetricCull,
+  MetricAppendPoints,
+  MetricRemeshRegions,
+  MetricPointQuery,
+  MetricBakePointCache,
+  // counters
+  MetricPointsRead,
+  MetricPointsConverted,
+  MetricPointsGathered,
+  MetricPointsExported,
+  MetricLeavesTouched,
+  MetricBytesRead,
+  MetricBytesWritten,
+  MetricMeshVertices,
+  MetricMeshTriangles,
+  MetricRegionsMeshed,
+  MetricLevelSetCacheHits,
+  MetricPointsTested,
+  // peaks
+  MetricPeakTrackedBytes, // largest grid, point buffer or mesh the library held at once, by its own accounting
+  MetricCount
+};
+
+enum PointMetricKind
+{
+  MetricTimer = 0,
+  MetricCounter = 1,
+  MetricPeak = 2
+};
+
+/// One metric as handed out through the C API.
+struct PointMetricRecord
+{
+  const char *name; // static, valid for the life of the process
+  PointMetricKind kind;
+  uint64_t calls; // timed scopes, counter updates or peak samples
+  uint64_t value; // nanoseconds, total or maximum
+};
+
+inline PointMetricKind pointMetricKind(PointMetricId id)
+{
+  return id < MetricPointsRead ? MetricTimer : (id < MetricPeakTrackedBytes ? MetricCounter : MetricPeak);
+}
+
+inline const char *pointMetricName(PointMetricId id)
+{
+  static const char *const names[MetricCount] = {
+      "read_ply", "compute_voxel_size", "create_point_index_grid", "create_point_data_grid",
+      "populate_attribute", "merge_grids", "build_lod", "write_file", "load_grid", "gather_points",
+      "rasterize", "resample", "volume_to_mesh", "export_points", "cull",
+      "append_points", "remesh_regions", "point_query", "bake_point_cache",
+      "points_read", "points_converted", "points_gathered", "points_exported", "leaves_touched",
+      "bytes_read", "bytes_written", "mesh_vertices", "mesh_triangles", "regions_meshed",
+      "level_set_cache_hits", "points_tested",
+      "peak_tracked_bytes"};
+  return names[id];
+}
+
+/// A set of metrics, updated with relaxed atomics so any thread may record into it.
+class PointMetrics
+{
+public:
+  PointMetrics() { this->reset(); }
+
+  void add(PointMetricId id, uint64_t value)
+  {
+    mCalls[id].fetch_add(1, memory_order_relaxed);
+    mValues[id].fetch_add(value, memory_order_relaxed);
+  }
+
+  void peak(PointMetricId id, uint64_t value)
+  {
+    mCalls[id].fetch_add(1, memory_order_relaxed);
+    uint64_t current = mValues[id].load(memory_order_relaxed);
+    while (current < value && !mValues[id].compare_exchange_weak(current, value, memory_order_relaxed))
+    {
+    }
+  }
+
+  void reset()
+  {
+    for (int i = 0; i < MetricCount; ++i)
+    {
+      mCalls[i].store(0, memory_order_relaxed);
+      mValues[i].store(0, memory_order_relaxed);
+    }
+  }
+
+  /// Fill up to capacity records and return MetricCount.
+  size_t read(PointMetricRecord *records, size_t capacity) const
+  {
+    for (size_t i = 0; i < capacity && i < size_t(MetricCount); ++i)
+    {
+      const PointMetricId id = PointMetricId(i);
+      records[i].name = pointMetricName(id);
+      records[i].kind = pointMetricKind(id);
+      records[i].calls = mCalls[i].load(memory_order_relaxed);
+      records[i].value = mValues[i].load(memory_order_relaxed);
+    }
+    return MetricCount;
+  }
+
+private:
+  atomic<uint64_t> mCalls[MetricCount];
+  atomic<uint64_t> mValues[MetricCount];
+};
+
+inline atomic<bool> &pointMetricsEnabled()
+{
+  static atomic<bool> enabled(true);
+  return enabled;
+}
+
+/// Totals over every call in the process.
+inline PointMetrics &processPointMetrics()
+{
+  static PointMetrics metrics;
+  return metrics;
+}
+
+/// Metrics of the reference or job the calling thread is working for, if any. Stages record from
+/// the thread that called into the library; parallel loops count locally and record once.
+inline PointMetrics *&currentPointMetrics()
+{
+  static thread_local PointMetrics *current = nullptr;
+  return current;
+}
+
+/// Record into the process totals and the current target, unless metrics are disabled.
+inline void recordPointMetric(PointMetricId id, uint64_t value)
+{
+  if (!pointMetricsEnabled().load(memory_order_relaxed))
+    return;
+  processPointMetrics().add(id, value);
+  if (PointMetrics *current = currentPointMetrics())
+    current->add(id, value);
+}
+
+inline void recordPointMetricPeak(PointMetricId id, uint64_t value)
+{
+  if (!pointMetricsEnabled().load(memory_order_relaxed))
+    return;
+  processPointMetrics().peak(id, value);
+  if (PointMetrics *current = currentPointMetrics())
+    current->peak(id, value);
+}
+
+/// Direct the calling thread's metrics to target for the lifetime of the scope.
+class PointMetricsScope
+{
+public:
+  explicit PointMetricsScope(PointMetrics *target) : mPrevious(currentPointMetrics()) { currentPointMetrics() = target; }
+  ~PointMetricsScope() { currentPointMetrics() = mPrevious; }
+
+private:
+  PointMetricsScope(const PointMetricsScope &);
+  PointMetricsScope &operator=(const PointMetricsScope &);
+  PointMetrics *mPrevious;
+};
+
+/// Add the time spent in the scope to a timer metric. Reads the clock only when metrics are enabled.
+class ScopedPointMetricTimer
+{
+public:
+  explicit ScopedPointMetricTimer(PointMetricId id)
+      : mId(id), mActive(pointMetricsEnabled().load(memory_order_relaxed))
+  {
+    if (mActive)
+      mStart = chrono::steady_clock::now();
+  }
+  ~ScopedPointMetricTimer()
+  {
+    if (mActive)
+      recordPointMetric(mId, uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - mStart).count()));
+  }
+
+private:
+  ScopedPointMetricTimer(const ScopedPointMetricTimer &);
+  ScopedPointMetricTimer &operator=(const ScopedPointMetricTimer &);
+  PointMetricId mId;
+  bool mActive;
+  chrono::steady_clock::time_point mStart;
+};
@@ -0,0 +1,357 @@
+#pragma once
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <openvdb/openvdb.h>
+#include <openvdb/math/DDA.h>
+#include <openvdb/math/Ray.h>
+#include <openvdb/points/PointDataGrid.h>
+#include "point-culling.h"
+#include "point-metrics.h"
+
+using namespace std;
+
+/// One point found by a query, as handed out through the C API.
+struct PointQueryHit
+{
+  uint64_t index;    // global point index, matching the order of the point export
+  float position[3]; // world space
+  float distance;    // world distance to the query position, or along the ray for picks
+};
+
+/// Global index of the first point of every leaf, found by leaf pointer, so a point reached through
+/// the tree gets the index it has in the point export. One entry per leaf and nothing per point.
+class PointQueryIndex
+{
+public:
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+
+  void build(const LeafBoundsTable &table, const vector<openvdb::Index64> &offsets)
+  {
+    mFirst.clear();
+    mFirst.reserve(table.size());
+    for (size_t idx = 0; idx < table.size(); ++idx)
+      mFirst[table.leaves[idx]] = offsets[idx];
+  }
+
+  size_t size() const { return mFirst.size(); }
+
+  void clear() { mFirst.clear(); }
+
+  openvdb::Index64 firstPoint(const LeafT &leaf) const
+  {
+    unordered_map<const LeafT *, openvdb::Index64>::const_iterator it = mFirst.find(&leaf);
+    return it == mFirst.end() ? 0 : it->second;
+  }
+
+private:
+  unordered_map<const LeafT *, openvdb::Index64> mFirst;
+};
+
+/// Rank of a point among the active points of its leaf, which is its index in the leaf unless
+/// inactive voxels before it hold points.
+inline openvdb::Index64 activePointRank(const PointQueryIndex::LeafT &leaf, openvdb::Index voxelOffset, openvdb::Index pointIndex)
+{
+  if (leaf.onPointCount() == leaf.pointCount())
+    return pointIndex;
+  openvdb::Index64 skipped = 0;
+  openvdb::Index begin = 0;
+  for (openvdb::Index n = 0; n < voxelOffset; ++n)
+  {
+    const openvdb::Index end = leaf.getValue(n);
+    if (!leaf.isValueOn(n))
+      skipped += end - begin;
+    begin = end;
+  }
+  return pointIndex - skipped;
+}
+
+/// Interval [t0, t1] of a ray inside a box, false if it misses.
+inline bool rayBoxInterval(const openvdb::Vec3d &eye, const openvdb::Vec3d &invDir, const openvdb::Vec3d &boxMin,
+                           const openvdb::Vec3d &boxMax, double &t0, double &t1)
+{
+  t0 = -numeric_limits<double>::max();
+  t1 = numeric_limits<double>::max();
+  for (int c = 0; c < 3; ++c)
+  {
+    double a = (boxMin[c] - eye[c]) * invDir[c], b = (boxMax[c] - eye[c]) * invDir[c];
+    if (a > b)
+      swap(a, b);
+    // a ray parallel to the slab and inside it gives NaN bounds, which leave the interval as it is
+    t0 = a > t0 ? a : t0;
+    t1 = b < t1 ? b : t1;
+  }
+  return t0 <= t1;
+}
+
+/// Nearest point and sphere queries against the points of a grid with a linear transform and
+/// uniform voxels. Searches walk the tree and test only points in voxels within reach of the query,
+/// decoding "P" per voxel; no per point index is built. Not thread safe: each call makes its own.
+class PointQuery
+{
+public:
+  typedef openvdb::points::PointDataTree::LeafNodeType LeafT;
+  typedef openvdb::math::Ray<double> RayT;
+
+  PointQuery(const openvdb::points::PointDataGrid &grid, const PointQueryIndex &index)
+      : mGrid(grid), mIndex(index), mAccessor(grid.tree()), mVoxelSize(grid.voxelSize().x()), mPointsTested(0)
+  {
+  }
+
+  /// The point nearest the ray origin along a world ray, among those within radius of it and no
+  /// further than maxDistance along it (0 for no limit). Leaf cells the ray crosses are walked with
+  /// a DDA; each leaf in reach is walked again voxel by voxel, testing the points of crossed voxels
+  /// and of the voxels within radius of them. Stops once no later leaf can hold a nearer point.
+  bool pick(const openvdb::Vec3d &worldOrigin, const openvdb::Vec3d &worldDirection, double worldRadius,
+            double maxDistance, PointQueryHit &hit)
+  {
+    const openvdb::math::Transform &transform = mGrid.transform();
+    const openvdb::CoordBBox active = mGrid.tree().evalActiveVoxelBoundingBox();
+    if (active.empty() || worldDirection.lengthSqr() == 0.0)
+      return false;
+    // shift index space by half a voxel so voxel ijk spans [ijk, ijk + 1), as the DDA steps
+    const openvdb::Vec3d eye = transform.worldToIndex(worldOrigin) + openvdb::Vec3d(0.5);
+    openvdb::Vec3d dir = transform.worldToIndex(worldOrigin + worldDirection) + openvdb::Vec3d(0.5) - eye;
+    dir.normalize();
+    const openvdb::Vec3d invDir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+    const double radius = worldRadius / mVoxelSize;
+
+    double tBegin, tEnd;
+    const openvdb::Vec3d reach(radius + 1.0);
+    if (!rayBoxInterval(eye, invDir, active.min().asVec3d() - reach, active.max().asVec3d() + openvdb::Vec3d(1.0) + reach,
+                        tBegin, tEnd))
+      return false;
+    tBegin = max(tBegin, 0.0);
+    if (maxDistance > 0.0)
+      tEnd = min(tEnd, maxDistance / mVoxelSize);
+    if (tBegin > tEnd)
+      return false;
+
+    const int dim = int(LeafT::DIM);
+    const int leafReach = max(int(ceil(radius / dim)), 1);
+    // leaves tested from a later cell can't reach the ray earlier than this before its entry
+    const double lookBehind = double((leafReach + 1) * dim) * sqrt(3.0);
+    const RayT ray(eye, dir, tBegin, tEnd);
+    openvdb::math::DDA<RayT, LeafT::LOG2DIM> dda(ray, tBegin, tEnd);
+    unordered_set<const LeafT *> visited;
+    Candidate best;
+    size_t leavesTouched = 0;
+    mPointsTested = 0;
+    do
+    {
+      if (dda.time() - lookBehind > best.t)
+        break;
+      const openvdb::Coord cell = dda.voxel();
+      for (int i = -leafReach; i <= leafReach; ++i)
+        for (int j = -leafReach; j <= leafReach; ++j)
+          for (int k = -leafReach; k <= leafReach; ++k)
+          {
+            const LeafT *leaf = mAccessor.probeConstLeaf(cell.offsetBy(i * dim, j * dim, k * dim));
+            if (!leaf || !visited.insert(leaf).second)
+              continue;
+            double t0, t1;
+            const openvdb::Vec3d origin = leaf->origin().asVec3d();
+            if (!rayBoxInterval(eye, invDir, origin - openvdb::Vec3d(radius), origin + openvdb::Vec3d(dim + radius), t0, t1))
+              continue;
+            t0 = max(t0, tBegin);
+            t1 = min(t1, tEnd);
+            if (t0 > t1 || t0 > best.t)
+              continue;
+            ++leavesTouched;
+            this->pickInLeaf(*leaf, eye, dir, radius, t0, t1, tBegin, tEnd, best);
+          }
+    } while (dda.step());
+    recordPointMetric(MetricLeavesTouched, leavesTouched);
+    recordPointMetric(MetricPointsTested, mPointsTested);
+    if (!best.leaf)
+      return false;
+    this->fillHit(best, transform, hit);
+    return true;
+  }
+
+  /// Points within worldRadius of a world position, nearest first.
+  void sphere(const openvdb::Vec3d &worldCenter, double worldRadius, vector<PointQueryHit> &hits)
+  {
+    vector<Candidate> candidates;
+    mPointsTested = 0;
+    this->gatherSphere(mGrid.transform().worldToIndex(worldCenter), worldRadius / mVoxelSize, candidates);
+    recordPointMetric(MetricPointsTested, mPointsTested);
+    sort(candidates.begin(), candidates.end());
+    this->fillHits(candidates, candidates.size(), hits);
+  }
+
+  /// The k points nearest a world position within maxDistance (0 for no limit), nearest first.
+  /// Searches spheres of doubling radius from half a leaf until one holds k points.
+  void nearest(const openvdb::Vec3d &worldCenter, size_t k, double maxDistance, vector<PointQueryHit> &hits)
+  {
+    hits.clear();
+    const openvdb::CoordBBox active = mGrid.tree().evalActiveVoxelBoundingBox();
+    if (k == 0 || active.empty())
+      return;
+    const openvdb::Vec3d center = mGrid.transform().worldToIndex(worldCenter);
+    // the farthest any point can be from center
+    double farthest = 0.0;
+    for (int c = 0; c < 8; ++c)
+    {
+      const openvdb::Vec3d corner(c & 1 ? active.max().x() + 0.5 : active.min().x() - 0.5,
+                                  c & 2 ? active.max().y() + 0.5 : active.min().y() - 0.5,
+                                  c & 4 ? active.max().z() + 0.5 : active.min().z() - 0.5);
+      farthest = max(farthest, (corner - center).length());
+    }
+    const double limit = maxDistance > 0.0 ? min(maxDistance / mVoxelSize, farthest) : farthest;
+    vector<Candidate> candidates;
+    mPointsTested = 0;
+    for (double radius = min(0.5 * double(LeafT::DIM), limit);; radius = min(radius * 2.0, limit))
+    {
+      candidates.clear();
+      this->gatherSphere(center, radius, candidates);
+      if (candidates.size() >= k || radius >= limit)
+        break;
+    }
+    recordPointMetric(MetricPointsTested, mPointsTested);
+    const size_t count = min(k, candidates.size());
+    partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+    this->fillHits(candidates, count, hits);
+  }
+
+private:
+  /// A point found, by its leaf and index within it; t is the distance that orders candidates.
+  struct Candidate
+  {
+    const LeafT *leaf;
+    openvdb::Index voxelOffset, pointIndex;
+    openvdb::Vec3d position; // index space
+    double t;
+
+    Candidate() : leaf(nullptr), voxelOffset(0), pointIndex(0), t(numeric_limits<double>::max()) {}
+    bool operator<(const Candidate &other) const { return t < other.t; }
+  };
+
+  /// Test the points of every voxel of leaf the ray crosses in [t0, t1], and of the voxels within
+  /// radius of those, keeping the first along the ray within [tBegin, tEnd] in best.
+  void pickInLeaf(const LeafT &leaf, const openvdb::Vec3d &eye, const openvdb::Vec3d &dir, double radius,
+                  double t0, double t1, double tBegin, double tEnd, Candidate &best)
+  {
+    openvdb::points::AttributeHandle<openvdb::Vec3f> positionHandle(leaf.constAttributeArray("P"));
+    const openvdb::CoordBBox leafBox = leaf.getNodeBoundingBox();
+    const double radiusSqr = radius * radius;
+    // a point within radius of the ray lies at most this many voxels from a crossed voxel
+    const int voxelReach = int(floor(radius + 1.0));
+    bitset<LeafT::SIZE> tested;
+    const RayT ray(eye, dir, t0, t1);
+    openvdb::math::DDA<RayT, 0> dda(ray, t0, t1);
+    do
+    {
+      const openvdb::Coord crossed = dda.voxel();
+      for (int i = -voxelReach; i <= voxelReach; ++i)
+        for (int j = -voxelReach; j <= voxelReach; ++j)
+          for (int k = -voxelReach; k <= voxelReach; ++k)
+          {
+            const openvdb::Coord ijk = crossed.offsetBy(i, j, k);
+            if (!leafBox.isInside(ijk))
+              continue;
+            const openvdb::Index offset = LeafT::coordToOffset(ijk);
+            if (tested[offset] || !leaf.isValueOn(offset))
+              continue;
+            tested[offset] = true;
+            const openvdb::Index end = leaf.getValue(offset);
+            openvdb::Index n = offset > 0 ? leaf.getValue(offset - 1) : 0;
+            mPointsTested += end - n;
+            for (; n < end; ++n)
+            {
+              const openvdb::Vec3d p = openvdb::Vec3d(positionHandle.get(n)) + ijk.asVec3d() + openvdb::Vec3d(0.5);
+              const openvdb::Vec3d toPoint = p - eye;
+              const double t = toPoint.dot(dir);
+              if (t < tBegin || t > tEnd || t >= best.t)
+                continue;
+              if ((toPoint - dir * t).lengthSqr() > radiusSqr)
+                continue;
+              best.leaf = &leaf;
+              best.voxelOffset = offset;
+              best.pointIndex = n;
+              best.position = p - openvdb::Vec3d(0.5);
+              best.t = t;
+            }
+          }
+    } while (dda.step());
+  }
+
+  /// Add every active point within radius of an index space center to candidates, with t its distance.
+  void gatherSphere(const openvdb::Vec3d &center, double radius, vector<Candidate> &candidates)
+  {
+    // points sit up to half a voxel from their voxel's center
+    const openvdb::CoordBBox voxels(openvdb::Coord::round(center - openvdb::Vec3d(radius)),
+                                    openvdb::Coord::round(center + openvdb::Vec3d(radius)));
+    const double radiusSqr = radius * radius;
+    const int dim = int(LeafT::DIM);
+    const openvdb::Coord lo = voxels.min() & ~(dim - 1), hi = voxels.max() & ~(dim - 1);
+    size_t leavesTouched = 0;
+    for (int x = lo.x(); x <= hi.x(); x += dim)
+      for (int y = lo.y(); y <= hi.y(); y += dim)
+        for (int z = lo.z(); z <= hi.z(); z += dim)
+        {
+          const LeafT *leaf = mAccessor.probeConstLeaf(openvdb::Coord(x, y, z));
+          if (!leaf || leaf->isEmpty())
+            continue;
+          ++leavesTouched;
+          openvdb::CoordBBox clipped = leaf->getNodeBoundingBox();
+          clipped.intersect(voxels);
+          if (clipped.empty())
+            continue;
+          openvdb::points::AttributeHandle<openvdb::Vec3f> positionHandle(leaf->constAttributeArray("P"));
+          for (auto ijk = clipped.begin(); ijk; ++ijk)
+          {
+            const openvdb::Index offset = LeafT::coordToOffset(*ijk);
+            if (!leaf->isValueOn(offset))
+              continue;
+            const openvdb::Index end = leaf->getValue(offset);
+            openvdb::Index n = offset > 0 ? leaf->getValue(offset - 1) : 0;
+            mPointsTested += end - n;
+            for (; n < end; ++n)
+            {
+              const openvdb::Vec3d p = openvdb::Vec3d(positionHandle.get(n)) + (*ijk).asVec3d();
+              const double distanceSqr = (p - center).lengthSqr();
+              if (distanceSqr > radiusSqr)
+                continue;
+              Candidate candidate;
+              candidate.leaf = leaf;
+              candidate.voxelOffset = offset;
+              candidate.pointIndex = n;
+              candidate.position = p;
+              candidate.t = sqrt(distanceSqr);
+              candidates.push_back(candidate);
+            }
+          }
+        }
+    recordPointMetric(MetricLeavesTouched, leavesTouched);
+  }
+
+  void fillHit(const Candidate &candidate, const openvdb::math::Transform &transform, PointQueryHit &hit) const
+  {
+    hit.index = mIndex.firstPoint(*candidate.leaf) +
+                activePointRank(*candidate.leaf, candidate.voxelOffset, candidate.pointIndex);
+    const openvdb::Vec3d world = transform.indexToWorld(candidate.position);
+    hit.position[0] = float(world.x());
+    hit.position[1] = float(world.y());
+    hit.position[2] = float(world.z());
+    hit.distance = float(candidate.t * mVoxelSize);
+  }
+
+  void fillHits(const vector<Candidate> &candidates, size_t count, vector<PointQueryHit> &hits) const
+  {
+    hits.resize(count);
+    for (size_t i = 0; i < count; ++i)
+      this->fillHit(candidates[i], mGrid.transform(), hits[i]);
+  }
+
+  const openvdb::points::PointDataGrid &mGrid;
+  const PointQueryIndex &mIndex;
+  openvdb::points::PointDataTree::ConstAccessor mAccessor;
+  double mVoxelSize;
+  uint64_t mPointsTested;
+};
@@ -1,11 +1,23 @@
+#pragma once
 #include <vector>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <limits>
+#include <type_traits>
 
-#include "vendor/tinyply.cpp"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include "vendor/tinyply.h"
+#include "mapped-file.h"
+#include "point-metrics.h"
 
 using namespace std;
+using namespace tinyply;
 
 struct PLYInfo {
   PLYInfo() : hasColor(false), hasNormals(false), hasFaces(false) {}
@@ -18,7 +30,7 @@ class PLYProperties {
   public:
     vector<string> rgb{"red", "green", "blue"};
     vector<string> position{"x", "y", "z"};
-    vector<string> normal{"nx", "ny", "nz", "r", "g", "b"};
+    vector<string> normal{"nx", "ny", "nz"};
     bool hasColor(string property) {
       return find(this->rgb.begin(), this->rgb.end(), property) != this->rgb.end();
     };
@@ -28,9 +40,24 @@ class PLYProperties {
     bool hasNormal(string property) {
       return find(this->normal.begin(), this->normal.end(), property) != this->normal.end();
     };
+    /// Index of property in names, or -1.
+    static int component(const vector<string>& names, const string& property) {
+      auto it = find(names.begin(), names.end(), property);
+      return it == names.end() ? -1 : int(it - names.begin());
+    }
+    /// Properties other than position, color and normals become attributes named after them,
+    /// when the name is one OpenVDB accepts.
+    bool isScalar(const tinyply::PlyProperty& property) {
+      if (property.isList || hasPosition(property.name) || hasColor(property.name) || hasNormal(property.name)) return false;
+      if (property.name.empty()) return false;
+      for (char c : property.name) {
+        if (!isalnum((unsigned char)c) && c != '_' && c != '|' && c != ':') return false;
+      }
+      return true;
+    }
 };
 
-PLYInfo checkPLYProperties(vector<tinyply::PlyElement> elements) {
+inline PLYInfo checkPLYProperties(vector<tinyply::PlyElement> elements) {
   PLYInfo info;
   PLYProperties properties;
   for (auto e : elements) {
@@ -46,19 +73,138 @@ PLYInfo checkPLYProperties(vector<tinyply::PlyElement> elements) {
   return info;
 };
 
+// Scalar conversion helpers for the mapped reader ------------------------------------------
+
+template <typename T>
+inline T loadPLYScalar(const uint8_t *src, bool swapBytes) {
+  uint8_t bytes[sizeof(T)];
+  if (swapBytes) {
+    for (size_t i = 0; i < sizeof(T); ++i) bytes[i] = src[sizeof(T) - 1 - i];
+  } else {
+    memcpy(bytes, src, sizeof(T));
+  }
+  T value;
+  memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+/// Converts a PLY scalar to a position component.
+struct PLYPositionConverter {
+  typedef float ValueType;
+  template <typename T>
+  static float convert(T value) { return (float)value; }
+};
+
+/// Keeps a PLY scalar in its own type.
+template <typename T>
+struct PLYCastConverter {
+  typedef T ValueType;
+  template <typename S>
+  static T convert(S value) { return (T)value; }
+};
+
+/// Converts a PLY scalar to a 16 bit color channel, for sources with more than 8 bits per channel.
+struct PLYWideColorConverter {
+  typedef uint16_t ValueType;
+  template <typename T>
+  static uint16_t convert(T value) {
+    double v = std::is_floating_point<T>::value
+      ? (double)value * 65535.0
+      : (double)value * 65535.0 / (double)numeric_limits<T>::max();
+    v = v < 0.0 ? 0.0 : (v > 65535.0 ? 65535.0 : v);
+    return (uint16_t)(v + 0.5);
+  }
+};
+
+/// Converts a PLY scalar to an 8 bit color channel. Integer channels are rescaled from
+/// their full range, floating point channels are assumed to be in [0, 1].
+struct PLYColorConverter {
+  typedef uint8_t ValueType;
+  template <typename T>
+  static uint8_t convert(T value) {
+    double v = std::is_floating_point<T>::value
+      ? (double)value * 255.0
+      : (double)value * 255.0 / (double)numeric_limits<T>::max();
+    v = v < 0.0 ? 0.0 : (v > 255.0 ? 255.0 : v);
+    return (uint8_t)(v + (std::is_floating_point<T>::value ? 0.5 : 0.0));
+  }
+};
+
+template <typename SrcT, typename ConverterT>
+inline void convertPLYColumn(const uint8_t *src, size_t srcStride, size_t count, bool swapBytes,
+                             typename ConverterT::ValueType *dst, size_t dstStride) {
+  if (swapBytes && sizeof(SrcT) > 1) {
+    for (size_t n = 0; n < count; ++n, src += srcStride, dst += dstStride)
+      *dst = ConverterT::convert(loadPLYScalar<SrcT>(src, true));
+  } else {
+    for (size_t n = 0; n < count; ++n, src += srcStride, dst += dstStride)
+      *dst = ConverterT::convert(loadPLYScalar<SrcT>(src, false));
+  }
+}
+
+template <typename ConverterT>
+inline void convertPLYColumn(tinyply::Type type, const uint8_t *src, size_t srcStride, size_t count,
+                             bool swapBytes, typename ConverterT::ValueType *dst, size_t dstStride) {
+  switch (type) {
+    case tinyply::Type::INT8:    convertPLYColumn<int8_t, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::UINT8:   convertPLYColumn<uint8_t, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::INT16:   convertPLYColumn<int16_t, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::UINT16:  convertPLYColumn<uint16_t, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::INT32:   convertPLYColumn<int32_t, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::UINT32:  convertPLYColumn<uint32_t, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::FLOAT32: convertPLYColumn<float, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    case tinyply::Type::FLOAT64: convertPLYColumn<double, ConverterT>(src, srcStride, count, swapBytes, dst, dstStride); break;
+    default: throw runtime_error("Unsupported PLY property type");
+  }
+}
+
+/// Copy a column of PLY scalars of type into dst, packed, in their own type.
+inline void copyPLYScalarColumn(tinyply::Type type, const uint8_t *src, size_t srcStride, size_t count,
+                                bool swapBytes, uint8_t *dst) {
+  switch (type) {
+    case tinyply::Type::INT8:    convertPLYColumn<int8_t, PLYCastConverter<int8_t>>(src, srcStride, count, swapBytes, (int8_t *)dst, 1); break;
+    case tinyply::Type::UINT8:   convertPLYColumn<uint8_t, PLYCastConverter<uint8_t>>(src, srcStride, count, swapBytes, dst, 1); break;
+    case tinyply::Type::INT16:   convertPLYColumn<int16_t, PLYCastConverter<int16_t>>(src, srcStride, count, swapBytes, (int16_t *)dst, 1); break;
+    case tinyply::Type::UINT16:  convertPLYColumn<uint16_t, PLYCastConverter<uint16_t>>(src, srcStride, count, swapBytes, (uint16_t *)dst, 1); break;
+    case tinyply::Type::INT32:   convertPLYColumn<int32_t, PLYCastConverter<int32_t>>(src, srcStride, count, swapBytes, (int32_t *)dst, 1); break;
+    case tinyply::Type::UINT32:  convertPLYColumn<uint32_t, PLYCastConverter<uint32_t>>(src, srcStride, count, swapBytes, (uint32_t *)dst, 1); break;
+    case tinyply::Type::FLOAT32: convertPLYColumn<float, PLYCastConverter<float>>(src, srcStride, count, swapBytes, (float *)dst, 1); break;
+    case tinyply::Type::FLOAT64: convertPLYColumn<double, PLYCastConverter<double>>(src, srcStride, count, swapBytes, (double *)dst, 1); break;
+    default: throw runtime_error("Unsupported PLY property type");
+  }
+}
+
+/// Color channels wider than 8 bits keep 16 bits.
+inline bool isWidePLYColor(tinyply::Type type) {
+  return type != tinyply::Type::UINT8 && type != tinyply::Type::INT8;
+}
+
 class PLYReader {
   public:
     template <typename PointType>
-    struct point { 
-      PointType x, y, z; 
+    struct point {
+      PointType x, y, z;
     };
     template <typename ColorType>
     struct rgb { ColorType r, g, b; };
 
+    /// A vertex property with no dedicated attribute, packed in its PLY type.
+    struct ScalarColumn {
+      string name;
+      tinyply::Type type;
+      vector<uint8_t> data;
+      size_t stride() const { return tinyply::PropertyTable[type].stride; }
+    };
+
+    /// Vertex columns of a cloud. Only vertices is always filled; color holds 8 bit colors and
+    /// wideColor 16 bit or float ones, never both.
     template <typename PointType, typename ColorType>
     struct PointData {
       vector<point<PointType>> vertices;
       vector<rgb<ColorType>> color;
+      vector<rgb<uint16_t>> wideColor;
+      vector<point<float>> normals;
+      vector<ScalarColumn> scalars;
     };
     template <typename T>
     static point<float> toFloat(const point<T> _point) {
@@ -69,62 +215,321 @@ class PLYReader {
       return p;
     }
 
+    /// Throws if the file can't be opened or parsed, or has no vertex positions.
     static PointData<float, uint8_t> readply(const string& filepath);
     // can create other functions if needed, i.e. readplydouble
+
+    /// Fallback for ascii files and layouts the mapped reader can't address directly.
+    static PointData<float, uint8_t> readplyStream(const string& filepath);
 };
 
-PLYReader::PointData<float, uint8_t> PLYReader::readply(const string& filepath) {
+/// Memory-mapped reader for binary PLY files. The vertex element is located from the header
+/// and its position and color columns are converted in parallel chunks straight into the
+/// output buffers, in any property order and either byte order.
+class PLYMappedReader {
+  public:
+    struct Column {
+      Column() : offset(0), type(tinyply::Type::INVALID) {}
+      size_t offset;
+      tinyply::Type type;
+      bool valid() const { return type != tinyply::Type::INVALID; }
+    };
+
+    explicit PLYMappedReader(const string& filepath)
+      : mFile(new MappedFile(filepath)), mBinary(false), mSwapBytes(false), mMappable(false),
+        mHeaderBytes(0), mVertexOffset(0), mVertexStride(0), mVertexCount(0) {
+      parseHeader();
+    }
+
+    /// True when the vertex element is binary with fixed size records at a known offset.
+    bool isMappable() const { return mMappable; }
+    bool hasColor() const { return mColor[0].valid() && mColor[1].valid() && mColor[2].valid(); }
+    bool hasWideColor() const {
+      return hasColor() && (isWidePLYColor(mColor[0].type) || isWidePLYColor(mColor[1].type) || isWidePLYColor(mColor[2].type));
+    }
+    bool hasNormals() const { return mNormal[0].valid() && mNormal[1].valid() && mNormal[2].valid(); }
+    /// Bytes per point of the columns beyond position and 8 bit color, as read.
+    size_t attributeBytesPerPoint() const {
+      size_t bytes = (hasWideColor() ? 3 * sizeof(uint16_t) : 0) + (hasNormals() ? 3 * sizeof(float) : 0);
+      for (const ScalarInfo& scalar : mScalars) bytes += tinyply::PropertyTable[scalar.column.type].stride;
+      return bytes;
+    }
+    size_t vertexCount() const { return mVertexCount; }
+    const vector<tinyply::PlyElement>& elements() const { return mElements; }
+
+    /// Convert vertices [begin, end) into data, resizing its buffers to end - begin.
+    void read(size_t begin, size_t end, PLYReader::PointData<float, uint8_t>& data) const {
+      if (!mMappable) throw runtime_error("PLY vertex data can't be mapped");
+      ScopedPointMetricTimer timer(MetricReadPLY);
+      end = min(end, mVertexCount);
+      begin = min(begin, end);
+      recordPointMetric(MetricPointsRead, end - begin);
+      recordPointMetric(MetricBytesRead, (end - begin) * mVertexStride);
+      const uint8_t *base = mFile->data() + mVertexOffset + begin * mVertexStride;
+      mFile->adviseSequential(base - mFile->data(), (end - begin) * mVertexStride);
+      convert(base, mVertexStride, end - begin, data, true);
+    }
+
+    /// Convert positions of an evenly strided subset of about count vertices into data.
+    void sample(size_t count, PLYReader::PointData<float, uint8_t>& data) const {
+      if (!mMappable) throw runtime_error("PLY vertex data can't be mapped");
+      count = min(count, mVertexCount);
+      if (count == 0) return convert(nullptr, 0, 0, data, false);
+      const size_t step = mVertexCount / count;
+      convert(mFile->data() + mVertexOffset, mVertexStride * step, count, data, false);
+    }
+
+    /// Drop the pages backing vertices [begin, end) once they have been consumed.
+    void release(size_t begin, size_t end) const {
+      end = min(end, mVertexCount);
+      if (begin >= end) return;
+      mFile->release(mVertexOffset + begin * mVertexStride, (end - begin) * mVertexStride);
+    }
+
+  private:
+    struct ScalarInfo {
+      string name;
+      Column column;
+    };
+
+    /// Convert count records into data, every column in the same parallel pass, or positions only.
+    void convert(const uint8_t *base, size_t recordStep, size_t count,
+                 PLYReader::PointData<float, uint8_t>& data, bool attributes) const {
+      const bool wide = attributes && hasWideColor();
+      const bool narrow = attributes && hasColor() && !wide;
+      const bool normals = attributes && hasNormals();
+      data.vertices.resize(count);
+      data.color.resize(narrow ? count : 0);
+      data.wideColor.resize(wide ? count : 0);
+      data.normals.resize(normals ? count : 0);
+      data.scalars.resize(attributes ? mScalars.size() : 0);
+      for (size_t i = 0; i < data.scalars.size(); ++i) {
+        data.scalars[i].name = mScalars[i].name;
+        data.scalars[i].type = mScalars[i].column.type;
+        data.scalars[i].data.resize(count * data.scalars[i].stride());
+      }
+      if (count == 0) return;
+
+      float *positions = &data.vertices[0].x;
+      uint8_t *colors = narrow ? &data.color[0].r : nullptr;
+      uint16_t *wideColors = wide ? &data.wideColor[0].r : nullptr;
+      float *normalValues = normals ? &data.normals[0].x : nullptr;
+      const bool swapBytes = mSwapBytes;
+      const Column *position = mPosition, *color = mColor, *normal = mNormal;
+
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, count, 1 << 16),
+        [&](const tbb::blocked_range<size_t>& range) {
+          const size_t n = range.begin(), chunk = range.size();
+          const uint8_t *src = base + n * recordStep;
+          for (int c = 0; c < 3; ++c) {
+            convertPLYColumn<PLYPositionConverter>(position[c].type, src + position[c].offset, recordStep,
+                                                   chunk, swapBytes, positions + n * 3 + c, 3);
+            if (colors != nullptr)
+              convertPLYColumn<PLYColorConverter>(color[c].type, src + color[c].offset, recordStep,
+                                                  chunk, swapBytes, colors + n * 3 + c, 3);
+            if (wideColors != nullptr)
+              convertPLYColumn<PLYWideColorConverter>(color[c].type, src + color[c].offset, recordStep,
+                                                      chunk, swapBytes, wideColors + n * 3 + c, 3);
+            if (normalValues != nullptr)
+              convertPLYColumn<PLYPositionConverter>(normal[c].type, src + normal[c].offset, recordStep,
+                                                     chunk, swapBytes, normalValues + n * 3 + c, 3);
+          }
+          for (size_t i = 0; i < data.scalars.size(); ++i) {
+            PLYReader::ScalarColumn& scalar = data.scalars[i];
+            copyPLYScalarColumn(scalar.type, src + mScalars[i].column.offset, recordStep, chunk, swapBytes,
+                                scalar.data.data() + n * scalar.stride());
+          }
+        });
+    }
+
+    void parseHeader() {
+      const uint8_t *data = mFile->data();
+      const size_t size = mFile->size();
+      static const char endHeader[] = "end_header";
+      const uint8_t *end = data + size;
+      const uint8_t *found = search(data, end, endHeader, endHeader + sizeof(endHeader) - 1);
+      if (found == end) throw runtime_error("PLY header is missing end_header");
+      const uint8_t *payload = found + sizeof(endHeader) - 1;
+      while (payload < end && *payload != '\n') ++payload;
+      if (payload < end) ++payload;
+      mHeaderBytes = payload - data;
+
+      string header((const char *)data, mHeaderBytes);
+      istringstream headerStream(header);
+      tinyply::PlyFile file;
+      if (!file.parse_header(headerStream)) throw runtime_error("Malformed PLY header");
+      mElements = file.get_elements();
+
+      string line;
+      istringstream lines(header);
+      while (getline(lines, line)) {
+        istringstream ls(line);
+        string token, format;
+        ls >> token;
+        if (token != "format") continue;
+        ls >> format;
+        mBinary = format == "binary_little_endian" || format == "binary_big_endian";
+        const uint16_t probe = 1;
+        const bool hostLittleEndian = *(const uint8_t *)&probe == 1;
+        mSwapBytes = mBinary && ((format == "binary_big_endian") == hostLittleEndian);
+        break;
+      }
+      if (!mBinary) return;
+
+      // the vertex block starts after every element that precedes it, which is only known
+      // without scanning when those elements have fixed size records
+      size_t offset = mHeaderBytes;
+      for (const tinyply::PlyElement& element : mElements) {
+        size_t stride = 0;
+        bool fixed = true;
+        for (const tinyply::PlyProperty& property : element.properties) {
+          if (property.isList) fixed = false;
+          stride += tinyply::PropertyTable[property.propertyType].stride;
+        }
+        if (element.name != "vertex") {
+          if (!fixed) return;
+          offset += stride * element.size;
+          continue;
+        }
+        if (!fixed) return;
+        size_t propertyOffset = 0;
+        PLYProperties names;
+        for (const tinyply::PlyProperty& property : element.properties) {
+          Column column;
+          column.offset = propertyOffset;
+          column.type = property.propertyType;
+          int c;
+          if ((c = PLYProperties::component(names.position, property.name)) >= 0) mPosition[c] = column;
+          else if ((c = PLYProperties::component(names.rgb, property.name)) >= 0) mColor[c] = column;
+          else if ((c = PLYProperties::component(names.normal, property.name)) >= 0) mNormal[c] = column;
+          else if (names.isScalar(property)) {
+            ScalarInfo scalar;
+            scalar.name = property.name;
+            scalar.column = column;
+            mScalars.push_back(scalar);
+          }
+          propertyOffset += tinyply::PropertyTable[property.propertyType].stride;
+        }
+        if (!mPosition[0].valid() || !mPosition[1].valid() || !mPosition[2].valid())
+          throw runtime_error("PLY vertex element has no x, y, z properties");
+        mVertexOffset = offset;
+        mVertexStride = stride;
+        mVertexCount = element.size;
+        if (mVertexOffset + mVertexStride * mVertexCount > mFile->size())
+          throw runtime_error("PLY file is truncated");
+        mMappable = true;
+        return;
+      }
+      throw runtime_error("PLY file has no vertex element");
+    }
+
+    unique_ptr<MappedFile> mFile;
+    vector<tinyply::PlyElement> mElements;
+    bool mBinary;
+    bool mSwapBytes;
+    bool mMappable;
+    size_t mHeaderBytes;
+    size_t mVertexOffset;
+    size_t mVertexStride;
+    size_t mVertexCount;
+    Column mPosition[3];
+    Column mColor[3];
+    Column mNormal[3];
+    vector<ScalarInfo> mScalars;
+};
+
+inline PLYReader::PointData<float, uint8_t> PLYReader::readply(const string& filepath) {
   PointData<float, uint8_t> plyData;
+  PLYMappedReader reader(filepath);
+  if (!reader.isMappable()) return readplyStream(filepath);
+  reader.read(0, reader.vertexCount(), plyData);
+  return plyData;
+}
 
-  try {
-    ifstream filestream(filepath, ios::binary);
-    if (filestream.fail()) throw runtime_error("Failed to open " + filepath);
-    tinyply::PlyFile file;
-    file.parse_header(filestream);
-    shared_ptr<PlyData> vertices, col;
-    PLYInfo info = checkPLYProperties(file.get_elements());
+inline PLYReader::PointData<float, uint8_t> PLYReader::readplyStream(const string& filepath) {
+  PointData<float, uint8_t> plyData;
+  ScopedPointMetricTimer timer(MetricReadPLY);
+  ifstream filestream(filepath, ios::binary);
+  if (filestream.fail()) throw runtime_error("Failed to open " + filepath);
+  tinyply::PlyFile file;
+  file.parse_header(filestream);
+  shared_ptr<PlyData> vertices, col, norm;
+  PLYInfo info = checkPLYProperties(file.get_elements());
 
-    // Check for properties ------------------------------------------------------------------
-    try { vertices = file.request_properties_from_element("vertex", { "x", "y", "z" }); }
+  // Check for properties ------------------------------------------------------------------
+  // positions are required, so a file without them throws
+  vertices = file.request_properties_from_element("vertex", { "x", "y", "z" });
+
+  if (info.hasColor == true) {
+    try { col = file.request_properties_from_element("vertex", { "red", "green", "blue" }); }
 		catch (const exception & e) { cerr << "tinyply exception: " << e.what() << endl; }
-    
-    if (info.hasColor == true) {
-      try { col = file.request_properties_from_element("vertex", { "red", "green", "blue" }); }
-  		catch (const exception & e) { cerr << "tinyply exception: " << e.what() << endl; }
+  }
+
+  if (info.hasNormals == true) {
+    try { norm = file.request_properties_from_element("vertex", { "nx", "ny", "nz" }); }
+    catch (const exception & e) { cerr << "tinyply exception: " << e.what() << endl; }
+  }
+
+  // every other scalar vertex property, requested one by one since their types may differ
+  PLYProperties properties;
+  vector<pair<string, shared_ptr<PlyData>>> scalars;
+  for (const tinyply::PlyElement& element : file.get_elements()) {
+    if (element.name != "vertex") continue;
+    for (const tinyply::PlyProperty& property : element.properties) {
+      if (!properties.isScalar(property)) continue;
+      try { scalars.push_back(make_pair(property.name, file.request_properties_from_element("vertex", { property.name }))); }
+      catch (const exception & e) { cerr << "tinyply exception: " << e.what() << endl; }
     }
+  }
 
-    file.read(filestream);
+  file.read(filestream);
+  size_t bytesRead = (vertices ? vertices->buffer.size_bytes() : 0) + (col ? col->buffer.size_bytes() : 0) +
+                     (norm ? norm->buffer.size_bytes() : 0);
+  for (const auto& scalar : scalars) bytesRead += scalar.second->buffer.size_bytes();
+  recordPointMetric(MetricBytesRead, bytesRead);
 
-    // Vertices -------------------------------------------------------------------------------
+  // Vertices -------------------------------------------------------------------------------
+  // tinyply has already resolved byte order, so columns are converted straight into the output
 
-    const size_t verticesBytes = vertices->buffer.size_bytes();
-    vector<PLYReader::point<float>> points(vertices->count);
-    if (vertices->t == tinyply::Type::FLOAT64) {
-      /* Attempting to cast to another type results in munmap_chunk error so we need to read in
-         as tinyply::Type and do explicit conversion via transform - will break that into its own function 
-      */
-      vector<PLYReader::point<double>> tmp(vertices->count);
-      memcpy(tmp.data(), vertices->buffer.get(), verticesBytes);
-      transform(tmp.begin(), tmp.end(), points.begin(), PLYReader::toFloat<double>);
-    } else {
-      memcpy(points.data(), vertices->buffer.get(), verticesBytes);
-    }
-    
-    plyData.vertices = points;
+  const size_t stride = tinyply::PropertyTable[vertices->t].stride;
+  recordPointMetric(MetricPointsRead, vertices->count);
+  plyData.vertices.resize(vertices->count);
+  if (vertices->count > 0) {
+    convertPLYColumn<PLYPositionConverter>(vertices->t, vertices->buffer.get(), stride,
+                                           vertices->count * 3, false, &plyData.vertices[0].x, 1);
+  }
 
-    // Color ----------------------------------------------------------------------------------
+  // Color ----------------------------------------------------------------------------------
 
-    if (info.hasColor == true) {
-      // TODO check if color is float32
-      const size_t rgbBytes = col->buffer.size_bytes();
-      vector<rgb<uint8_t>> color(col->count);
-      memcpy(color.data(), col->buffer.get(), rgbBytes);
-      plyData.color = color;
+  if (info.hasColor == true && col && col->count > 0) {
+    const size_t colorStride = tinyply::PropertyTable[col->t].stride;
+    if (isWidePLYColor(col->t)) {
+      plyData.wideColor.resize(col->count);
+      convertPLYColumn<PLYWideColorConverter>(col->t, col->buffer.get(), colorStride,
+                                              col->count * 3, false, &plyData.wideColor[0].r, 1);
+    } else {
+      plyData.color.resize(col->count);
+      convertPLYColumn<PLYColorConverter>(col->t, col->buffer.get(), colorStride,
+                                          col->count * 3, false, &plyData.color[0].r, 1);
     }
+  }
+
+  // Normals and scalars ---------------------------------------------------------------------
 
-    return plyData;
-  } catch(exception &e) {
-    cerr << "Caught tinyply exception: " << e.what() << endl;
-    return plyData;
+  if (norm && norm->count > 0) {
+    plyData.normals.resize(norm->count);
+    convertPLYColumn<PLYPositionConverter>(norm->t, norm->buffer.get(), tinyply::PropertyTable[norm->t].stride,
+                                           norm->count * 3, false, &plyData.normals[0].x, 1);
   }
-}
\ No newline at end of file
+  for (const auto& scalar : scalars) {
+    PLYReader::ScalarColumn column;
+    column.name = scalar.first;
+    column.type = scalar.second->t;
+    column.data.resize(scalar.second->count * column.stride());
+    copyPLYScalarColumn(column.type, scalar.second->buffer.get(), column.stride(), scalar.second->count, false,
+                        column.data.data());
+    plyData.scalars.push_back(column);
+  }
+
+  return plyData;
+}
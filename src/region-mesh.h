@@ -0,0 +1,196 @@
+#pragma once
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+#include <openvdb/openvdb.h>
+#include <openvdb/points/PointDataGrid.h>
+#include "mesh-data.h"
+
+using namespace std;
+
+/// Regions are cubes of 2^REGION_LOG2DIM point voxels (4 point leaves a side), keyed by the
+/// point index coordinate shifted down by REGION_LOG2DIM.
+static const int REGION_LOG2DIM = 5;
+
+inline openvdb::Coord regionKeyOfVoxel(const openvdb::Coord &ijk)
+{
+  return openvdb::Coord(ijk.x() >> REGION_LOG2DIM, ijk.y() >> REGION_LOG2DIM, ijk.z() >> REGION_LOG2DIM);
+}
+
+/// Point index space voxels of a region.
+inline openvdb::CoordBBox regionVoxelBounds(const openvdb::Coord &key)
+{
+  const openvdb::Coord min(key.x() << REGION_LOG2DIM, key.y() << REGION_LOG2DIM, key.z() << REGION_LOG2DIM);
+  return openvdb::CoordBBox(min, min.offsetBy((1 << REGION_LOG2DIM) - 1));
+}
+
+/// Add the key of every region overlapping voxels to regions.
+inline void addRegionKeys(const openvdb::CoordBBox &voxels, set<openvdb::Coord> &regions)
+{
+  const openvdb::Coord lo = regionKeyOfVoxel(voxels.min()), hi = regionKeyOfVoxel(voxels.max());
+  for (int i = lo.x(); i <= hi.x(); ++i)
+    for (int j = lo.y(); j <= hi.y(); ++j)
+      for (int k = lo.z(); k <= hi.z(); ++k)
+        regions.insert(openvdb::Coord(i, j, k));
+}
+
+/// Triangles of one region with their own vertex list, ready to hand to Unity as one sub-mesh.
+struct RegionMesh
+{
+  vector<openvdb::Vec3s> vertices;
+  vector<openvdb::Vec3I> triangles;
+
+  /// Keep the polygons of mesh whose centroid falls in region key of a grid with transform.
+  /// Neighbouring regions mesh the same level set values along their shared border, so each
+  /// polygon there is built by both and kept by exactly one.
+  void extract(const MeshData &mesh, const openvdb::math::Transform &transform, const openvdb::Coord &key)
+  {
+    vertices.clear();
+    triangles.clear();
+    VertexRemap remap;
+    const openvdb::Vec3s *p = mesh.points.get();
+    for (size_t i = 0; i < mesh.polygonPoolCount; ++i)
+    {
+      const openvdb::tools::PolygonPool &pool = mesh.polygons[i];
+      for (size_t t = 0, e = pool.numTriangles(); t < e; ++t)
+      {
+        const openvdb::Vec3I &tri = pool.triangle(t);
+        if (regionKeyOfPolygon(transform, p, &tri[0], 3) == key)
+          this->addTriangle(remap, p, tri[0], tri[1], tri[2]);
+      }
+      for (size_t q = 0, e = pool.numQuads(); q < e; ++q)
+      {
+        const openvdb::Vec4I &quad = pool.quad(q);
+        if (regionKeyOfPolygon(transform, p, &quad[0], 4) == key)
+          this->addQuad(remap, p, quad);
+      }
+    }
+  }
+
+  bool empty() const { return triangles.empty(); }
+
+  void copyVertices(float *out) const
+  {
+    if (!vertices.empty())
+      memcpy(out, vertices.data(), vertices.size() * sizeof(openvdb::Vec3s));
+  }
+
+  void copyTriangles(uint32_t *out) const
+  {
+    if (!triangles.empty())
+      memcpy(out, triangles.data(), triangles.size() * sizeof(openvdb::Vec3I));
+  }
+
+  /// Area weighted vertex normals, as MeshData::computeNormals.
+  void computeNormals(float *out) const
+  {
+    memset(out, 0, vertices.size() * 3 * sizeof(float));
+    openvdb::Vec3s *normals = reinterpret_cast<openvdb::Vec3s *>(out);
+    for (size_t t = 0; t < triangles.size(); ++t)
+    {
+      const openvdb::Vec3I &tri = triangles[t];
+      const openvdb::Vec3s n = (vertices[tri[1]] - vertices[tri[0]]).cross(vertices[tri[2]] - vertices[tri[0]]);
+      normals[tri[0]] += n;
+      normals[tri[1]] += n;
+      normals[tri[2]] += n;
+    }
+    for (size_t n = 0; n < vertices.size(); ++n)
+      normals[n].normalize();
+  }
+
+  /// Mesh vertex index to index in vertices.
+  typedef unordered_map<uint32_t, uint32_t> VertexRemap;
+
+  /// Region owning a polygon of count vertices, by its centroid in the point grid's index space.
+  static openvdb::Coord regionKeyOfPolygon(const openvdb::math::Transform &transform, const openvdb::Vec3s *p,
+                                           const uint32_t *indices, int count)
+  {
+    openvdb::Vec3d centroid(0.0);
+    for (int c = 0; c < count; ++c)
+      centroid += openvdb::Vec3d(p[indices[c]]);
+    return regionKeyOfVoxel(openvdb::Coord::round(transform.worldToIndex(centroid / double(count))));
+  }
+
+  void addTriangle(VertexRemap &remap, const openvdb::Vec3s *p, uint32_t a, uint32_t b, uint32_t c)
+  {
+    triangles.push_back(openvdb::Vec3I(this->vertex(remap, p, a), this->vertex(remap, p, b), this->vertex(remap, p, c)));
+  }
+
+  void addQuad(VertexRemap &remap, const openvdb::Vec3s *p, const openvdb::Vec4I &quad)
+  {
+    const uint32_t a = this->vertex(remap, p, quad[0]), b = this->vertex(remap, p, quad[1]);
+    const uint32_t c = this->vertex(remap, p, quad[2]), d = this->vertex(remap, p, quad[3]);
+    triangles.push_back(openvdb::Vec3I(a, b, c));
+    triangles.push_back(openvdb::Vec3I(a, c, d));
+  }
+
+private:
+  uint32_t vertex(VertexRemap &remap, const openvdb::Vec3s *p, uint32_t index)
+  {
+    VertexRemap::iterator it = remap.find(index);
+    if (it != remap.end())
+      return it->second;
+    const uint32_t local = uint32_t(vertices.size());
+    remap[index] = local;
+    vertices.push_back(p[index]);
+    return local;
+  }
+};
+
+/// Sort every polygon of mesh into the region owning it, replacing regions. One pass over the
+/// mesh, for meshing a whole grid at once and handing it out by region.
+inline void splitMeshIntoRegions(const MeshData &mesh, const openvdb::math::Transform &transform,
+                                 map<openvdb::Coord, RegionMesh> &regions)
+{
+  regions.clear();
+  map<openvdb::Coord, RegionMesh::VertexRemap> remaps;
+  const openvdb::Vec3s *p = mesh.points.get();
+  for (size_t i = 0; i < mesh.polygonPoolCount; ++i)
+  {
+    const openvdb::tools::PolygonPool &pool = mesh.polygons[i];
+    for (size_t t = 0, e = pool.numTriangles(); t < e; ++t)
+    {
+      const openvdb::Vec3I &tri = pool.triangle(t);
+      const openvdb::Coord key = RegionMesh::regionKeyOfPolygon(transform, p, &tri[0], 3);
+      regions[key].addTriangle(remaps[key], p, tri[0], tri[1], tri[2]);
+    }
+    for (size_t q = 0, e = pool.numQuads(); q < e; ++q)
+    {
+      const openvdb::Vec4I &quad = pool.quad(q);
+      const openvdb::Coord key = RegionMesh::regionKeyOfPolygon(transform, p, &quad[0], 4);
+      regions[key].addQuad(remaps[key], p, quad);
+    }
+  }
+}
+
+/// Region meshes of a grid and the bookkeeping to update them incrementally: the point leaves
+/// changed since the last remesh, and the regions the last remesh replaced.
+struct RegionMeshSet
+{
+  map<openvdb::Coord, RegionMesh> regions;
+  /// Origins of point leaves that gained points since the regions were last meshed.
+  set<openvdb::Coord> dirtyLeaves;
+  /// Keys of the regions the last remesh changed, including regions left without triangles,
+  /// which are no longer in regions.
+  vector<openvdb::Coord> delta;
+  /// Raster parameters the regions were built with; a change meshes every region again. Regions
+  /// are always meshed without adaptivity, so there is none to compare.
+  bool built;
+  double rasterVoxelSize;
+  float isoValue;
+
+  RegionMeshSet() : built(false), rasterVoxelSize(0.0), isoValue(0.0f) {}
+
+  bool matches(double voxelSize, float iso) const
+  {
+    return built && rasterVoxelSize == voxelSize && isoValue == iso;
+  }
+
+  const RegionMesh *find(const openvdb::Coord &key) const
+  {
+    map<openvdb::Coord, RegionMesh>::const_iterator it = regions.find(key);
+    return it == regions.end() ? nullptr : &it->second;
+  }
+};